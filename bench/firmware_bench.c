@@ -0,0 +1,153 @@
+/* Host benchmark for the firmware's per-sample hot paths, built from
+   the same sources as the firmware against the shims in shims/.
+
+   Prints one JSON object with a perf counter per operation, so runs
+   can be stored per commit and compared.
+
+   Usage: firmware_bench [iterations] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "am2320.h"
+#include "conn_manager.h"
+#include "history.h"
+#include "perf.h"
+#include "telemetry.h"
+#include "timebase.h"
+
+PERF_COUNTER(crc16);
+PERF_COUNTER(frame_decode);
+PERF_COUNTER(sample_encode);
+PERF_COUNTER(history_append);
+PERF_COUNTER(wifi_reconnect);
+
+/* Keeps results alive so the compiler cannot drop the work. */
+static volatile unsigned sink;
+
+/* Static so stdio never allocates and shows up in the heap reading. */
+static char stdout_buf[BUFSIZ];
+
+static uint64_t
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t
+heap_in_use()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  return mallinfo2().uordblks;
+#else
+  return 0;
+#endif
+}
+
+/* A valid AM2320 response for 45.6 %RH and 21.3 C. */
+static void
+make_frame(unsigned char *frame)
+{
+  unsigned char data[6] = { 0x03, 0x04, 0x01, 0xC8, 0x00, 0xD5 };
+  memcpy(frame, data, sizeof(data));
+  unsigned short crc = am2320_crc16(frame, 6);
+  frame[6] = crc & 0xFF;
+  frame[7] = crc >> 8;
+}
+
+int
+main(int argc, char **argv)
+{
+  int iterations = argc > 1 ? atoi(argv[1]) : 100000;
+  const char *commit = getenv("BENCH_COMMIT");
+  unsigned char frame[8];
+  am2320_measurement measurement;
+  char time_buf[32];
+  char payload[128];
+  int payload_bytes = 0;
+  size_t heap_before, heap_after;
+  uint64_t start_ns, encode_ns;
+
+  setvbuf(stdout, stdout_buf, _IOFBF, sizeof(stdout_buf));
+
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  make_frame(frame);
+  if (init_history() != ESP_OK) {
+    return 1;
+  }
+  struct timeval synced = { .tv_sec = 1600000000, .tv_usec = 0 };
+  timebase_record_sync(&synced);
+
+  /* Only the benchmarked loops are inside the heap readings. The first
+     libc time formatting call loads timezone state, so do it once
+     before taking the first reading. */
+  timebase_format(timebase_now(), time_buf, sizeof(time_buf));
+  heap_before = heap_in_use();
+
+  for (int i = 0; i < iterations; i++) {
+    PERF_BEGIN(crc16);
+    sink += am2320_crc16(frame, 6);
+    PERF_END(crc16);
+  }
+
+  for (int i = 0; i < iterations; i++) {
+    PERF_BEGIN(frame_decode);
+    sink += am2320_decode_frame(frame, &measurement);
+    PERF_END(frame_decode);
+  }
+
+  start_ns = now_ns();
+  for (int i = 0; i < iterations; i++) {
+    PERF_BEGIN(sample_encode);
+    timebase_format(timebase_now(), time_buf, sizeof(time_buf));
+    payload_bytes = telemetry_encode(payload, sizeof(payload), &measurement, time_buf);
+    PERF_END(sample_encode);
+    sink += payload_bytes;
+  }
+  encode_ns = (now_ns() - start_ns) / iterations;
+
+  for (int i = 0; i < iterations; i++) {
+    PERF_BEGIN(history_append);
+    history_add(timebase_now(), &measurement);
+    PERF_END(history_append);
+  }
+
+  /* Link loss followed by a successful immediate reconnect, the event
+     sequence the connection manager sees most often. */
+  conn_manager cm;
+  conn_manager_init(&cm, 1);
+  conn_manager_add_ap(&cm, "bench", "password");
+  conn_manager_scan_result seen = { .ssid = "bench", .channel = 6, .rssi = -60 };
+  conn_manager_event event = { .type = CONN_MANAGER_EVENT_START };
+  conn_manager_handle(&cm, &event);
+  event = (conn_manager_event){ .type = CONN_MANAGER_EVENT_SCAN_DONE, .results = &seen, .num_results = 1 };
+  conn_manager_handle(&cm, &event);
+  for (int i = 0; i < iterations; i++) {
+    PERF_BEGIN(wifi_reconnect);
+    event = (conn_manager_event){ .type = CONN_MANAGER_EVENT_GOT_IP, .now_ms = 2 * i + 1 };
+    conn_manager_handle(&cm, &event);
+    event = (conn_manager_event){ .type = CONN_MANAGER_EVENT_DISCONNECTED, .now_ms = 2 * i + 2 };
+    sink += conn_manager_handle(&cm, &event).type;
+    PERF_END(wifi_reconnect);
+  }
+
+  heap_after = heap_in_use();
+
+  printf("{\"benchmark\":\"firmware\",\"commit\":\"%s\",\"iterations\":%d,\"counters\":",
+         commit != NULL ? commit : "", iterations);
+  perf_write_json(stdout);
+  printf(",\"sample_encode_ns\":%llu,\"payload_bytes\":%d,\"heap_in_use_bytes\":%lld}\n",
+         (unsigned long long)encode_ns, payload_bytes,
+         (long long)heap_after - (long long)heap_before);
+  return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) { return (SemaphoreHandle_t)1; }
+static inline int xSemaphoreTake(SemaphoreHandle_t sem, uint32_t ticks) { return 1; }
+static inline int xSemaphoreGive(SemaphoreHandle_t sem) { return 1; }
+
+#endif
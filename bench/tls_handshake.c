@@ -0,0 +1,215 @@
+/* Measures mutual-TLS handshakes against a local broker using host
+   mbedTLS, to compare device credentials (RSA PEM against ECDSA DER).
+
+   The CA and client credentials are parsed once, as the firmware does,
+   and every iteration performs a full handshake on a fresh connection.
+
+   Usage: tls_handshake <label> <host> <port> <ca> <cert> <key> [iterations] */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/net_sockets.h"
+#include "mbedtls/platform.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/version.h"
+#include "mbedtls/x509_crt.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define read_cycles() __rdtsc()
+#else
+#define read_cycles() 0ULL
+#endif
+
+static size_t heap_current = 0;
+static size_t heap_peak = 0;
+
+#ifdef MBEDTLS_PLATFORM_MEMORY
+/* Each block carries its size in front so frees can be accounted. */
+static void *
+counting_calloc(size_t n, size_t size)
+{
+  size_t *block = calloc(1, sizeof(size_t) + n * size);
+  if (block == NULL) {
+    return NULL;
+  }
+  *block = n * size;
+  heap_current += n * size;
+  if (heap_current > heap_peak) {
+    heap_peak = heap_current;
+  }
+  return block + 1;
+}
+
+static void
+counting_free(void *ptr)
+{
+  if (ptr == NULL) {
+    return;
+  }
+  size_t *block = (size_t *)ptr - 1;
+  heap_current -= *block;
+  free(block);
+}
+#endif
+
+static uint64_t
+now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+handshake_once(mbedtls_ssl_config *conf, const char *host, const char *port)
+{
+  mbedtls_net_context net;
+  mbedtls_ssl_context ssl;
+  int ret;
+
+  mbedtls_net_init(&net);
+  mbedtls_ssl_init(&ssl);
+
+  ret = mbedtls_net_connect(&net, host, port, MBEDTLS_NET_PROTO_TCP);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to connect to %s:%s: -0x%04x\n", host, port, -ret);
+    goto cleanup;
+  }
+
+  ret = mbedtls_ssl_setup(&ssl, conf);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to set up ssl context: -0x%04x\n", -ret);
+    goto cleanup;
+  }
+
+  ret = mbedtls_ssl_set_hostname(&ssl, host);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to set hostname: -0x%04x\n", -ret);
+    goto cleanup;
+  }
+  mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, NULL);
+
+  while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
+    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+      fprintf(stderr, "Handshake failed: -0x%04x\n", -ret);
+      goto cleanup;
+    }
+  }
+  mbedtls_ssl_close_notify(&ssl);
+
+ cleanup:
+  mbedtls_ssl_free(&ssl);
+  mbedtls_net_free(&net);
+  return ret;
+}
+
+int
+main(int argc, char **argv)
+{
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context ctr_drbg;
+  mbedtls_ssl_config conf;
+  mbedtls_x509_crt ca;
+  mbedtls_x509_crt cert;
+  mbedtls_pk_context key;
+  uint64_t parse_ns, total_ns = 0, total_cycles = 0;
+  size_t heap_base;
+  int iterations = 20;
+  int ret = 1;
+
+  if (argc < 7) {
+    fprintf(stderr, "usage: %s <label> <host> <port> <ca> <cert> <key> [iterations]\n",
+            argv[0]);
+    return 1;
+  }
+  if (argc > 7) {
+    iterations = atoi(argv[7]);
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+#ifdef MBEDTLS_PLATFORM_MEMORY
+  mbedtls_platform_set_calloc_free(counting_calloc, counting_free);
+#endif
+
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ctr_drbg_init(&ctr_drbg);
+  mbedtls_ssl_config_init(&conf);
+  mbedtls_x509_crt_init(&ca);
+  mbedtls_x509_crt_init(&cert);
+  mbedtls_pk_init(&key);
+
+  if (mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, NULL, 0) != 0) {
+    fprintf(stderr, "Failed to seed drbg\n");
+    goto cleanup;
+  }
+
+  parse_ns = now_ns();
+  if (mbedtls_x509_crt_parse_file(&ca, argv[4]) != 0
+      || mbedtls_x509_crt_parse_file(&cert, argv[5]) != 0
+#if MBEDTLS_VERSION_MAJOR >= 3
+      || mbedtls_pk_parse_keyfile(&key, argv[6], NULL,
+                                  mbedtls_ctr_drbg_random, &ctr_drbg) != 0
+#else
+      || mbedtls_pk_parse_keyfile(&key, argv[6], NULL) != 0
+#endif
+      ) {
+    fprintf(stderr, "Failed to parse credentials\n");
+    goto cleanup;
+  }
+  parse_ns = now_ns() - parse_ns;
+
+  if (mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                  MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+    fprintf(stderr, "Failed to set ssl config defaults\n");
+    goto cleanup;
+  }
+  mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+  mbedtls_ssl_conf_ca_chain(&conf, &ca, NULL);
+  if (mbedtls_ssl_conf_own_cert(&conf, &cert, &key) != 0) {
+    fprintf(stderr, "Failed to configure client certificate\n");
+    goto cleanup;
+  }
+  mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+
+  heap_base = heap_current;
+  heap_peak = heap_current;
+  for (int i = 0; i < iterations; i++) {
+    uint64_t start_ns = now_ns();
+    uint64_t start_cycles = read_cycles();
+    if (handshake_once(&conf, argv[2], argv[3]) != 0) {
+      goto cleanup;
+    }
+    total_cycles += read_cycles() - start_cycles;
+    total_ns += now_ns() - start_ns;
+  }
+
+  printf("{\"benchmark\": \"tls_handshake\", \"label\": \"%s\", \"iterations\": %d, "
+         "\"parse_ns\": %llu, \"handshake_ns\": %llu, \"handshake_cycles\": %llu, ",
+         argv[1], iterations, (unsigned long long)parse_ns,
+         (unsigned long long)(total_ns / iterations),
+         (unsigned long long)(total_cycles / iterations));
+#ifdef MBEDTLS_PLATFORM_MEMORY
+  printf("\"heap_peak_bytes\": %zu}\n", heap_peak - heap_base);
+#else
+  fprintf(stderr, "mbedTLS built without MBEDTLS_PLATFORM_MEMORY, heap peak not measured\n");
+  printf("\"heap_peak_bytes\": null}\n");
+#endif
+  ret = 0;
+
+ cleanup:
+  mbedtls_pk_free(&key);
+  mbedtls_x509_crt_free(&cert);
+  mbedtls_x509_crt_free(&ca);
+  mbedtls_ssl_config_free(&conf);
+  mbedtls_ctr_drbg_free(&ctr_drbg);
+  mbedtls_entropy_free(&entropy);
+  return ret;
+}
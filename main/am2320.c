@@ -16,26 +16,6 @@
 static const uint8_t AM2320_ADDRESS = 0x5C;
 static const char *TAG = "AM2320";
 
-static unsigned short
-crc16(unsigned char *buf, int len)
-{
-  unsigned short crc=0xFFFF;
-  while (len--) {
-    crc ^= *buf++;
-    for(int i = 0; i < 8; i++) {
-      if (crc & 0x01) {
-        crc >>= 1;
-        crc ^= 0xA001;
-      } else {
-        crc >>= 1;
-      }
-    }
-  }
-  
-  return crc;
-}
-
-
 static esp_err_t
 install_driver(int i2c_num, int sda, int scl)
 {
@@ -124,18 +104,11 @@ perform_measurement(int i2c_num, am2320_measurement *out)
       continue;
     }
 
-    unsigned short crc = (((int)buf[7]) << 8) + ((int)buf[6]);
-    if (crc != crc16(buf, 6)) {
+    err = am2320_decode_frame(buf, out);
+    if (err != ESP_OK) {
       ESP_LOGD(TAG, "%s(%d): Invalid CRC", __FUNCTION__, __LINE__);
       continue;
     }
-
-    float humidity = (((int)buf[2]) << 8) + buf[3];
-    humidity /= 10;
-    float temperature = (((int)buf[4]) << 8) + buf[5];
-    temperature /= 10;
-    out->temperature = temperature;
-    out->relative_humidity = humidity;
     return ESP_OK;
   }
   return err;
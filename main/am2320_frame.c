@@ -0,0 +1,40 @@
+#include "am2320.h"
+
+/* Frame handling kept free of driver includes so it also builds on the
+   host, see bench/. */
+
+unsigned short
+am2320_crc16(const unsigned char *buf, int len)
+{
+  unsigned short crc=0xFFFF;
+  while (len--) {
+    crc ^= *buf++;
+    for(int i = 0; i < 8; i++) {
+      if (crc & 0x01) {
+        crc >>= 1;
+        crc ^= 0xA001;
+      } else {
+        crc >>= 1;
+      }
+    }
+  }
+  
+  return crc;
+}
+
+esp_err_t
+am2320_decode_frame(const unsigned char *buf, am2320_measurement *out)
+{
+  unsigned short crc = (((int)buf[7]) << 8) + ((int)buf[6]);
+  if (crc != am2320_crc16(buf, 6)) {
+    return ESP_ERR_INVALID_CRC;
+  }
+
+  float humidity = (((int)buf[2]) << 8) + buf[3];
+  humidity /= 10;
+  float temperature = (((int)buf[4]) << 8) + buf[5];
+  temperature /= 10;
+  out->temperature = temperature;
+  out->relative_humidity = humidity;
+  return ESP_OK;
+}
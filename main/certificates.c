@@ -1,12 +1,30 @@
+#include "sdkconfig.h"
 #include "esp_tls.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "certificates.h"
 
 const char *TAG = "CAStore";
 
-extern const uint8_t ca_cert_pem_start[] asm("_binary_ca_pem_start");
-extern const uint8_t ca_cert_pem_end[] asm("_binary_ca_pem_end");
+extern const uint8_t ca_cert_der_start[] asm("_binary_ca_der_start");
+extern const uint8_t ca_cert_der_end[] asm("_binary_ca_der_end");
 
+#ifdef CONFIG_DEVICE_CREDENTIALS_ECDSA
+extern const uint8_t client_cert_start[] asm("_binary_temperature_sensor_ecdsa_der_start");
+extern const uint8_t client_cert_end[] asm("_binary_temperature_sensor_ecdsa_der_end");
+
+extern const uint8_t client_key_start[] asm("_binary_temperature_sensor_ecdsa_key_der_start");
+extern const uint8_t client_key_end[] asm("_binary_temperature_sensor_ecdsa_key_der_end");
+#else
+extern const uint8_t client_cert_start[] asm("_binary_temperature_sensor_pem_start");
+extern const uint8_t client_cert_end[] asm("_binary_temperature_sensor_pem_end");
+
+extern const uint8_t client_key_start[] asm("_binary_temperature_sensor_key_start");
+extern const uint8_t client_key_end[] asm("_binary_temperature_sensor_key_end");
+#endif
+
+/* The CA is parsed from DER once into the global store, which both the
+   MQTT client and the OTA updater use for every connection. */
 esp_err_t setup_global_ca_store() {
   esp_err_t err;
   err = esp_tls_init_global_ca_store();
@@ -15,10 +33,17 @@ esp_err_t setup_global_ca_store() {
     return err;
   }
   
-  err = esp_tls_set_global_ca_store(ca_cert_pem_start, ca_cert_pem_end - ca_cert_pem_start);
+  err = esp_tls_set_global_ca_store(ca_cert_der_start, ca_cert_der_end - ca_cert_der_start);
   if (err != ESP_OK) {
-    ESP_LOGE(TAG, "Failed to set global cert pem: %s", esp_err_to_name(err));
+    ESP_LOGE(TAG, "Failed to set global cert der: %s", esp_err_to_name(err));
     return err;
   }
   return ESP_OK;
 }
+
+void get_device_credentials(device_credentials *out) {
+  out->cert = (const char *)client_cert_start;
+  out->cert_len = client_cert_end - client_cert_start;
+  out->key = (const char *)client_key_start;
+  out->key_len = client_key_end - client_key_start;
+}
@@ -1,4 +1,12 @@
-COMPONENT_EMBED_TXTFILES :=  ${PROJECT_PATH}/certificate-collection/ca/ca.pem \
-	                     ${PROJECT_PATH}/certificate-collection/certificates/temperature_sensor.pem \
-	                     ${PROJECT_PATH}/certificate-collection/certificates/temperature_sensor.key \
-	                     ${PROJECT_PATH}/certificate-collection/ca/ca.der
+COMPONENT_EMBED_FILES := ${PROJECT_PATH}/certificate-collection/ca/ca.der
+
+ifdef CONFIG_DEVICE_CREDENTIALS_ECDSA
+ifeq ($(wildcard ${PROJECT_PATH}/certificate-collection/certificates/temperature_sensor_ecdsa*.der),)
+$(error ECDSA device credentials not found. Run tools/gen_ecdsa_credentials.sh or disable CONFIG_DEVICE_CREDENTIALS_ECDSA)
+endif
+COMPONENT_EMBED_FILES +=     ${PROJECT_PATH}/certificate-collection/certificates/temperature_sensor_ecdsa.der \
+	                     ${PROJECT_PATH}/certificate-collection/certificates/temperature_sensor_ecdsa_key.der
+else
+COMPONENT_EMBED_TXTFILES :=  ${PROJECT_PATH}/certificate-collection/certificates/temperature_sensor.pem \
+	                     ${PROJECT_PATH}/certificate-collection/certificates/temperature_sensor.key
+endif
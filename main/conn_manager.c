@@ -0,0 +1,277 @@
+#include <string.h>
+#include "conn_manager.h"
+
+static int
+score(const conn_manager_ap *ap)
+{
+  int successes = ap->successes > CONN_MANAGER_SUCCESS_CAP ? CONN_MANAGER_SUCCESS_CAP : ap->successes;
+  int failures = ap->failures > 8 ? 8 : ap->failures;
+  int rssi = ap->channel != 0 ? ap->rssi : -100;
+  return rssi + 4 * successes - 8 * failures;
+}
+
+static uint32_t
+next_random(conn_manager *cm)
+{
+  uint32_t x = cm->random_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  cm->random_state = x;
+  return x;
+}
+
+/* Best ranked AP not yet tried this round and, if mask is non-zero,
+   among the APs in mask. */
+static int
+pick_ap(const conn_manager *cm, uint8_t mask)
+{
+  int best = -1;
+  for (int i = 0; i < cm->num_aps; i++) {
+    if (cm->tried & (1 << i)) {
+      continue;
+    }
+    if (mask && !(mask & (1 << i))) {
+      continue;
+    }
+    if (best < 0 || score(&cm->aps[i]) > score(&cm->aps[best])) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+static conn_manager_action
+connect_to(conn_manager *cm, int ap)
+{
+  conn_manager_action action = {
+    .type = CONN_MANAGER_ACTION_CONNECT,
+    .ap = ap,
+    .channel = cm->aps[ap].channel
+  };
+  cm->current = ap;
+  cm->tried |= 1 << ap;
+  cm->state = CONN_MANAGER_CONNECTING;
+  return action;
+}
+
+static conn_manager_action
+scan(conn_manager *cm, uint8_t channel)
+{
+  conn_manager_action action = {
+    .type = CONN_MANAGER_ACTION_SCAN,
+    .ap = -1,
+    .channel = channel
+  };
+  cm->scan_channel = channel;
+  cm->state = CONN_MANAGER_SCANNING;
+  return action;
+}
+
+/* Jittered exponential backoff: half the delay is fixed, the other half
+   random, so a fleet that lost the same AP does not retry in lockstep. */
+static conn_manager_action
+backoff(conn_manager *cm)
+{
+  uint32_t delay = CONN_MANAGER_BACKOFF_MAX_MS;
+  if (cm->attempt < 16 && (CONN_MANAGER_BACKOFF_MIN_MS << cm->attempt) < delay) {
+    delay = CONN_MANAGER_BACKOFF_MIN_MS << cm->attempt;
+  }
+  conn_manager_action action = {
+    .type = CONN_MANAGER_ACTION_WAIT,
+    .ap = -1,
+    .delay_ms = delay / 2 + next_random(cm) % (delay / 2 + 1)
+  };
+  cm->attempt++;
+  cm->current = -1;
+  cm->state = CONN_MANAGER_BACKOFF;
+  return action;
+}
+
+/* Starts a round over all APs. The scan is limited to the channel of
+   the best ranked AP when that is known, which is much faster than a
+   full scan; a full scan follows only if that finds nothing. */
+static conn_manager_action
+start_round(conn_manager *cm)
+{
+  conn_manager_action none = { .type = CONN_MANAGER_ACTION_NONE, .ap = -1 };
+  cm->tried = 0;
+  int best = pick_ap(cm, 0);
+  if (best < 0) {
+    cm->state = CONN_MANAGER_IDLE;
+    return none;
+  }
+  return scan(cm, cm->aps[best].channel);
+}
+
+static conn_manager_action
+handle_scan_done(conn_manager *cm, const conn_manager_event *event)
+{
+  uint8_t seen = 0;
+
+  for (int i = 0; i < cm->num_aps; i++) {
+    conn_manager_ap *ap = &cm->aps[i];
+    const conn_manager_scan_result *strongest = NULL;
+    for (int j = 0; j < event->num_results; j++) {
+      const conn_manager_scan_result *result = &event->results[j];
+      if (strcmp(result->ssid, ap->ssid) == 0
+          && (strongest == NULL || result->rssi > strongest->rssi)) {
+        strongest = result;
+      }
+    }
+    if (strongest != NULL) {
+      if (!ap->bssid_known || ap->channel != strongest->channel
+          || memcmp(ap->bssid, strongest->bssid, sizeof(ap->bssid)) != 0) {
+        cm->dirty = true;
+      }
+      ap->rssi = strongest->rssi;
+      ap->channel = strongest->channel;
+      memcpy(ap->bssid, strongest->bssid, sizeof(ap->bssid));
+      ap->bssid_known = true;
+      seen |= 1 << i;
+    } else if (cm->scan_channel == 0) {
+      /* Not anywhere in range, forget where it used to be. */
+      if (ap->channel != 0 || ap->bssid_known) {
+        cm->dirty = true;
+      }
+      ap->channel = 0;
+      ap->bssid_known = false;
+    }
+  }
+
+  int ap = seen ? pick_ap(cm, seen) : -1;
+  if (ap >= 0) {
+    return connect_to(cm, ap);
+  }
+  if (cm->scan_channel != 0) {
+    return scan(cm, 0);
+  }
+  return backoff(cm);
+}
+
+void conn_manager_init(conn_manager *cm, uint32_t seed)
+{
+  memset(cm, 0, sizeof(*cm));
+  cm->state = CONN_MANAGER_IDLE;
+  cm->current = -1;
+  cm->random_state = seed != 0 ? seed : 1;
+}
+
+bool conn_manager_add_ap(conn_manager *cm, const char *ssid, const char *password)
+{
+  int slot = -1;
+
+  if (strlen(ssid) >= CONN_MANAGER_SSID_LEN || strlen(password) >= CONN_MANAGER_PASSWORD_LEN) {
+    return false;
+  }
+
+  for (int i = 0; i < cm->num_aps; i++) {
+    if (strcmp(cm->aps[i].ssid, ssid) == 0) {
+      if (strcmp(cm->aps[i].password, password) != 0) {
+        strcpy(cm->aps[i].password, password);
+        cm->dirty = true;
+      }
+      cm->aps[i].failures = 0;
+      return true;
+    }
+  }
+
+  if (cm->num_aps < CONN_MANAGER_MAX_APS) {
+    slot = cm->num_aps++;
+  } else {
+    /* Newly provisioned credentials replace the worst ranked AP. */
+    slot = 0;
+    for (int i = 1; i < cm->num_aps; i++) {
+      if (score(&cm->aps[i]) < score(&cm->aps[slot])) {
+        slot = i;
+      }
+    }
+    if (cm->current == slot) {
+      cm->current = -1;
+    }
+  }
+
+  memset(&cm->aps[slot], 0, sizeof(cm->aps[slot]));
+  strcpy(cm->aps[slot].ssid, ssid);
+  strcpy(cm->aps[slot].password, password);
+  cm->tried &= ~(1 << slot);
+  cm->dirty = true;
+  return true;
+}
+
+conn_manager_action conn_manager_handle(conn_manager *cm, const conn_manager_event *event)
+{
+  conn_manager_action none = { .type = CONN_MANAGER_ACTION_NONE, .ap = -1 };
+  int next;
+
+  switch (event->type) {
+  case CONN_MANAGER_EVENT_START:
+    cm->attempt = 0;
+    return start_round(cm);
+
+  case CONN_MANAGER_EVENT_SCAN_DONE:
+    if (cm->state != CONN_MANAGER_SCANNING) {
+      return none;
+    }
+    return handle_scan_done(cm, event);
+
+  case CONN_MANAGER_EVENT_SCAN_FAILED:
+    /* Nothing was learned about the APs, so keep what we know and
+       retry later instead of falling through to a full scan. */
+    if (cm->state != CONN_MANAGER_SCANNING) {
+      return none;
+    }
+    return backoff(cm);
+
+  case CONN_MANAGER_EVENT_GOT_IP:
+    if (cm->current >= 0) {
+      conn_manager_ap *ap = &cm->aps[cm->current];
+      if (ap->successes < CONN_MANAGER_SUCCESS_CAP || ap->failures != 0) {
+        cm->dirty = true;
+      }
+      if (ap->successes < CONN_MANAGER_SUCCESS_CAP) {
+        ap->successes++;
+      }
+      ap->failures = 0;
+    }
+    if (cm->link_lost) {
+      cm->last_reconnect_ms = event->now_ms - cm->link_lost_ms;
+      cm->reconnects++;
+      cm->link_lost = false;
+    }
+    cm->attempt = 0;
+    cm->state = CONN_MANAGER_CONNECTED;
+    return none;
+
+  case CONN_MANAGER_EVENT_DISCONNECTED:
+    if (cm->state == CONN_MANAGER_CONNECTED) {
+      cm->link_lost = true;
+      cm->link_lost_ms = event->now_ms;
+      cm->tried = 0;
+      /* Go straight back to the AP we just had, pinned to its channel
+         and BSSID, before considering anything slower. */
+      if (cm->current >= 0) {
+        return connect_to(cm, cm->current);
+      }
+      return start_round(cm);
+    }
+    if (cm->state != CONN_MANAGER_CONNECTING) {
+      return none;
+    }
+    if (cm->current >= 0) {
+      cm->aps[cm->current].failures++;
+    }
+    next = pick_ap(cm, 0);
+    if (next >= 0 && cm->aps[next].channel != 0) {
+      return connect_to(cm, next);
+    }
+    return backoff(cm);
+
+  case CONN_MANAGER_EVENT_TIMER:
+    if (cm->state != CONN_MANAGER_BACKOFF) {
+      return none;
+    }
+    return start_round(cm);
+  }
+  return none;
+}
@@ -0,0 +1,102 @@
+#include <math.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "history.h"
+
+static const char *TAG = "history";
+
+static history_entry entries[HISTORY_CAPACITY];
+/* Sequence number of the next entry to be written. Entry seq lives at
+   entries[(seq - 1) % HISTORY_CAPACITY]. */
+static uint32_t next_seq = 1;
+static uint32_t boot_id;
+static SemaphoreHandle_t history_mutex = NULL;
+
+static uint32_t
+oldest_seq()
+{
+  return next_seq > HISTORY_CAPACITY ? next_seq - HISTORY_CAPACITY : 1;
+}
+
+esp_err_t init_history()
+{
+  history_mutex = xSemaphoreCreateMutex();
+  if (history_mutex == NULL) {
+    ESP_LOGE(TAG, "Failed to create history mutex");
+    return ESP_ERR_NO_MEM;
+  }
+  boot_id = esp_random();
+  return ESP_OK;
+}
+
+void history_add(timebase_stamp_t stamp, const am2320_measurement *measurement)
+{
+  history_entry entry = {
+    .uptime_s = stamp / 1000000LL,
+    .temperature_dc = lroundf(measurement->temperature * 10),
+    .relative_humidity_dpm = lroundf(measurement->relative_humidity * 10)
+  };
+
+  xSemaphoreTake(history_mutex, portMAX_DELAY);
+  entries[(next_seq - 1) % HISTORY_CAPACITY] = entry;
+  next_seq++;
+  xSemaphoreGive(history_mutex);
+}
+
+uint32_t history_latest_seq()
+{
+  uint32_t seq;
+  xSemaphoreTake(history_mutex, portMAX_DELAY);
+  seq = next_seq - 1;
+  xSemaphoreGive(history_mutex);
+  return seq;
+}
+
+uint32_t history_boot_id()
+{
+  return boot_id;
+}
+
+int history_read(uint32_t seq, history_entry *out, int max, uint32_t *first_seq)
+{
+  int n = 0;
+  xSemaphoreTake(history_mutex, portMAX_DELAY);
+  if (seq < oldest_seq()) {
+    seq = oldest_seq();
+  }
+  *first_seq = seq;
+  while (n < max && seq < next_seq) {
+    out[n++] = entries[(seq - 1) % HISTORY_CAPACITY];
+    seq++;
+  }
+  xSemaphoreGive(history_mutex);
+  return n;
+}
+
+uint32_t history_seq_since(timebase_stamp_t stamp)
+{
+  uint32_t lo, hi;
+  uint32_t uptime_s = stamp < 0 ? 0 : stamp / 1000000LL;
+
+  /* Entries are appended in time order, so binary search the ring. */
+  xSemaphoreTake(history_mutex, portMAX_DELAY);
+  lo = oldest_seq();
+  hi = next_seq;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (entries[(mid - 1) % HISTORY_CAPACITY].uptime_s < uptime_s) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  xSemaphoreGive(history_mutex);
+  return lo;
+}
+
+timebase_stamp_t history_entry_stamp(const history_entry *entry)
+{
+  return (timebase_stamp_t)entry->uptime_s * 1000000LL;
+}
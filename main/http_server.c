@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_http_server.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "mdns.h"
+#include "history.h"
+#include "timebase.h"
+
+static const char *TAG = "http_server";
+
+#define HISTORY_MAX_HOURS 24
+#define HISTORY_BATCH 32
+
+/* Sets the ETag header and answers 304 if the client already has it.
+   Returns true when the response has been sent. */
+static bool
+not_modified(httpd_req_t *req, const char *etag)
+{
+  char if_none_match[32];
+
+  httpd_resp_set_hdr(req, "ETag", etag);
+  httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+  if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                  sizeof(if_none_match)) == ESP_OK
+      && strcmp(if_none_match, etag) == 0) {
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return true;
+  }
+  return false;
+}
+
+/* Sequence numbers restart on every boot, so the boot id keeps a client
+   from being told it is current with data from before a reboot. */
+static void
+format_etag(char *buf, size_t len, uint32_t seq)
+{
+  snprintf(buf, len, "\"%08x-%u\"", (unsigned)history_boot_id(), (unsigned)seq);
+}
+
+static int
+format_entry(char *buf, size_t len, const history_entry *entry, const char *sep)
+{
+  char time_buf[32];
+  if (timebase_format(history_entry_stamp(entry), time_buf, sizeof(time_buf)) != ESP_OK) {
+    return -1;
+  }
+  return snprintf(buf, len,
+                  "%s{\"temperature\":%s%d.%d,\"relative_humidity\":%u.%u,\"time\":\"%s\"}",
+                  sep, entry->temperature_dc < 0 ? "-" : "",
+                  abs(entry->temperature_dc) / 10, abs(entry->temperature_dc) % 10,
+                  entry->relative_humidity_dpm / 10, entry->relative_humidity_dpm % 10,
+                  time_buf);
+}
+
+static esp_err_t
+latest_handler(httpd_req_t *req)
+{
+  char etag[24];
+  char buf[128];
+  history_entry entry;
+  uint32_t seq = history_latest_seq();
+  uint32_t first_seq;
+
+  if (seq == 0 || history_read(seq, &entry, 1, &first_seq) != 1) {
+    return httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No samples yet");
+  }
+
+  format_etag(etag, sizeof(etag), seq);
+  if (not_modified(req, etag)) {
+    return ESP_OK;
+  }
+
+  if (format_entry(buf, sizeof(buf), &entry, "") < 0) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_sendstr(req, "Time not synced");
+  }
+  httpd_resp_set_type(req, "application/json");
+  return httpd_resp_sendstr(req, buf);
+}
+
+static esp_err_t
+history_handler(httpd_req_t *req)
+{
+  char etag[24];
+  char query[32];
+  char value[8];
+  char buf[HISTORY_BATCH * 96];
+  history_entry entries[HISTORY_BATCH];
+  int hours = HISTORY_MAX_HOURS;
+  uint32_t latest = history_latest_seq();
+  uint32_t seq, first_seq;
+  struct timeval tv;
+  const char *sep = "";
+  int n;
+
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK
+      && httpd_query_key_value(query, "hours", value, sizeof(value)) == ESP_OK) {
+    hours = atoi(value);
+    if (hours < 1 || hours > HISTORY_MAX_HOURS) {
+      return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "hours must be 1-24");
+    }
+  }
+
+  if (timebase_to_epoch(timebase_now(), &tv) != ESP_OK) {
+    httpd_resp_set_status(req, "503 Service Unavailable");
+    return httpd_resp_sendstr(req, "Time not synced");
+  }
+
+  format_etag(etag, sizeof(etag), latest);
+  if (not_modified(req, etag)) {
+    return ESP_OK;
+  }
+
+  /* Samples are streamed in batches, so only one batch is copied out of
+     the ring at a time and the history lock is not held while sending. */
+  httpd_resp_set_type(req, "application/json");
+  httpd_resp_send_chunk(req, "[", 1);
+  seq = history_seq_since(timebase_now() - (int64_t)hours * 3600LL * 1000000LL);
+  while (seq <= latest
+         && (n = history_read(seq, entries, HISTORY_BATCH, &first_seq)) > 0) {
+    size_t len = 0;
+    for (int i = 0; i < n && first_seq + i <= latest; i++) {
+      int written = format_entry(buf + len, sizeof(buf) - len, &entries[i], sep);
+      if (written < 0) {
+        continue;
+      }
+      len += written;
+      sep = ",";
+    }
+    /* A zero length chunk would end the chunked body. */
+    if (len > 0 && httpd_resp_send_chunk(req, buf, len) != ESP_OK) {
+      ESP_LOGW(TAG, "Client went away while sending history");
+      return ESP_FAIL;
+    }
+    seq = first_seq + n;
+  }
+  httpd_resp_send_chunk(req, "]", 1);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t start_http_server()
+{
+  httpd_handle_t server = NULL;
+  httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+  config.stack_size = 8192;
+  esp_err_t err;
+
+  const httpd_uri_t latest_uri = {
+    .uri = "/latest",
+    .method = HTTP_GET,
+    .handler = latest_handler
+  };
+  const httpd_uri_t history_uri = {
+    .uri = "/history",
+    .method = HTTP_GET,
+    .handler = history_handler
+  };
+
+  err = httpd_start(&server, &config);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start http server: %s", esp_err_to_name(err));
+    return err;
+  }
+
+  httpd_register_uri_handler(server, &latest_uri);
+  httpd_register_uri_handler(server, &history_uri);
+
+  mdns_txt_item_t txt[] = {
+    {"path", "/latest"}
+  };
+  err = mdns_service_add(NULL, "_http", "_tcp", config.server_port, txt, 1);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to advertise http service: %s", esp_err_to_name(err));
+    httpd_stop(server);
+    return err;
+  }
+  return ESP_OK;
+}
@@ -10,4 +10,8 @@ typedef struct {
 
 esp_err_t am2320_measure(int i2c_num, int sda, int scl, am2320_measurement *out);
 
+/* Decodes the 8 byte response to a read of registers 0x00-0x03. */
+esp_err_t am2320_decode_frame(const unsigned char *buf, am2320_measurement *out);
+unsigned short am2320_crc16(const unsigned char *buf, int len);
+
 #endif
@@ -1,8 +1,17 @@
 #ifndef CERTIFICATES_H
 #define CERTIFICATES_H
 
+#include <stddef.h>
 #include "esp_err.h"
 
+typedef struct {
+  const char *cert;
+  size_t cert_len;
+  const char *key;
+  size_t key_len;
+} device_credentials;
+
 esp_err_t setup_global_ca_store();
+void get_device_credentials(device_credentials *out);
 
 #endif
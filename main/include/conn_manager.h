@@ -0,0 +1,106 @@
+#ifndef CONN_MANAGER_H
+#define CONN_MANAGER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Wi-Fi connection manager. This is a plain state machine with no IDF
+   dependencies: wifi.c feeds it events and carries out the action it
+   returns, which keeps the policy itself easy to drive from a script. */
+
+#define CONN_MANAGER_MAX_APS 4
+#define CONN_MANAGER_SSID_LEN 33
+#define CONN_MANAGER_PASSWORD_LEN 65
+
+#define CONN_MANAGER_BACKOFF_MIN_MS 500U
+#define CONN_MANAGER_BACKOFF_MAX_MS 60000U
+
+/* Successes beyond this no longer improve an AP's rank. */
+#define CONN_MANAGER_SUCCESS_CAP 10
+
+typedef struct {
+  char ssid[CONN_MANAGER_SSID_LEN];
+  char password[CONN_MANAGER_PASSWORD_LEN];
+  uint8_t bssid[6];
+  bool bssid_known;
+  uint8_t channel;      /* 0 when not seen yet */
+  int8_t rssi;          /* from the last scan that saw it */
+  uint16_t successes;   /* saturates at CONN_MANAGER_SUCCESS_CAP */
+  uint16_t failures;    /* consecutive, reset on success */
+} conn_manager_ap;
+
+typedef enum {
+  CONN_MANAGER_IDLE,
+  CONN_MANAGER_SCANNING,
+  CONN_MANAGER_CONNECTING,
+  CONN_MANAGER_CONNECTED,
+  CONN_MANAGER_BACKOFF
+} conn_manager_state;
+
+typedef struct {
+  char ssid[CONN_MANAGER_SSID_LEN];
+  uint8_t bssid[6];
+  uint8_t channel;
+  int8_t rssi;
+} conn_manager_scan_result;
+
+typedef enum {
+  CONN_MANAGER_EVENT_START,
+  CONN_MANAGER_EVENT_SCAN_DONE,
+  CONN_MANAGER_EVENT_SCAN_FAILED,   /* the scan could not be started */
+  CONN_MANAGER_EVENT_GOT_IP,
+  CONN_MANAGER_EVENT_DISCONNECTED,
+  CONN_MANAGER_EVENT_TIMER
+} conn_manager_event_type;
+
+typedef struct {
+  conn_manager_event_type type;
+  uint32_t now_ms;
+  const conn_manager_scan_result *results;  /* SCAN_DONE only */
+  int num_results;
+} conn_manager_event;
+
+typedef enum {
+  CONN_MANAGER_ACTION_NONE,
+  CONN_MANAGER_ACTION_SCAN,     /* on channel, 0 for all channels */
+  CONN_MANAGER_ACTION_CONNECT,  /* to aps[ap], pinned to channel/bssid if known */
+  CONN_MANAGER_ACTION_WAIT      /* deliver a TIMER event after delay_ms */
+} conn_manager_action_type;
+
+typedef struct {
+  conn_manager_action_type type;
+  int ap;
+  uint8_t channel;
+  uint32_t delay_ms;
+} conn_manager_action;
+
+typedef struct {
+  conn_manager_state state;
+  conn_manager_ap aps[CONN_MANAGER_MAX_APS];
+  int num_aps;
+  int current;               /* AP being connected to, -1 if none */
+  uint8_t tried;             /* bitmask of APs tried this round */
+  uint8_t scan_channel;
+  uint32_t attempt;          /* failed rounds since the last connection */
+  uint32_t random_state;
+  bool link_lost;
+  uint32_t link_lost_ms;
+  /* Time from losing the link to getting an IP again, for the last
+     reconnect. */
+  uint32_t last_reconnect_ms;
+  uint32_t reconnects;
+  /* Set when something worth persisting in aps changed: credentials,
+     channel, BSSID or rank history. RSSI and in-round failures are
+     left out, they are re-learned after a reboot anyway. The owner
+     clears it after saving. */
+  bool dirty;
+} conn_manager;
+
+void conn_manager_init(conn_manager *cm, uint32_t seed);
+
+/* Adds or updates a provisioned AP. Returns false when the table is full. */
+bool conn_manager_add_ap(conn_manager *cm, const char *ssid, const char *password);
+
+conn_manager_action conn_manager_handle(conn_manager *cm, const conn_manager_event *event);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "am2320.h"
+#include "timebase.h"
+
+/* 24 hours of samples at one sample per 30 seconds. */
+#define HISTORY_CAPACITY 2880
+
+/* Compact in-RAM record, 8 bytes per sample. The AM2320 reports in
+   tenths, so nothing is lost by storing fixed point. */
+typedef struct {
+  uint32_t uptime_s;
+  int16_t temperature_dc;
+  uint16_t relative_humidity_dpm;
+} history_entry;
+
+esp_err_t init_history();
+void history_add(timebase_stamp_t stamp, const am2320_measurement *measurement);
+
+/* Sequence number of the newest sample, 0 while the history is empty.
+   It only grows while the device is up but restarts at 1 on every boot. */
+uint32_t history_latest_seq();
+
+/* Random value picked at init_history(). Together with the sequence
+   number it identifies a sample across reboots, as used for ETags. */
+uint32_t history_boot_id();
+
+/* Copies up to max entries with sequence numbers from seq onwards into
+   out, oldest first. seq is clamped to the oldest entry still kept.
+   Returns the number of entries copied and stores the sequence number
+   of the first one in first_seq. */
+int history_read(uint32_t seq, history_entry *out, int max, uint32_t *first_seq);
+
+/* Sequence number of the first sample taken at or after stamp. */
+uint32_t history_seq_since(timebase_stamp_t stamp);
+
+timebase_stamp_t history_entry_stamp(const history_entry *entry);
+
+#endif
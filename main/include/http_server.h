@@ -0,0 +1,8 @@
+#ifndef HTTP_SERVER_H
+#define HTTP_SERVER_H
+
+#include "esp_err.h"
+
+esp_err_t start_http_server();
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Cycle counters for hot paths. The same macros are used on target,
+   where they read CCOUNT and are compiled in with
+   CONFIG_PERF_INSTRUMENTATION, and in the host benchmarks in bench/,
+   where they read the time stamp counter. */
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#if __has_include("esp_cpu.h")
+#include "esp_cpu.h"
+#else
+#include "soc/cpu.h"
+#endif
+#ifdef CONFIG_PERF_INSTRUMENTATION
+#define PERF_ENABLED 1
+#endif
+typedef uint32_t perf_cycles_t;
+static inline perf_cycles_t perf_cycles() { return esp_cpu_get_ccount(); }
+#else
+#define PERF_ENABLED 1
+typedef uint64_t perf_cycles_t;
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline perf_cycles_t perf_cycles() { return __rdtsc(); }
+#else
+#include <time.h>
+static inline perf_cycles_t perf_cycles()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (perf_cycles_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+#endif
+
+typedef struct perf_counter {
+  const char *name;
+  uint32_t count;
+  uint64_t total;
+  perf_cycles_t max;
+  struct perf_counter *next;
+} perf_counter;
+
+#ifdef PERF_ENABLED
+#define PERF_COUNTER(counter) static perf_counter counter = { .name = #counter }
+#define PERF_BEGIN(counter) perf_cycles_t counter##_start = perf_cycles()
+#define PERF_END(counter) perf_record(&counter, perf_cycles() - counter##_start)
+#else
+#define PERF_COUNTER(counter)
+#define PERF_BEGIN(counter)
+#define PERF_END(counter)
+#endif
+
+void perf_record(perf_counter *counter, perf_cycles_t cycles);
+
+/* Writes every counter that has recorded something as a JSON array of
+   {"name", "count", "cycles_avg", "cycles_max"} objects. */
+void perf_write_json(FILE *out);
+
+#endif
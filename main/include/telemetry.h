@@ -0,0 +1,12 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include "am2320.h"
+
+/* Encodes a sample as the JSON payload published on topic/temperature.
+   Returns the payload length, or -1 if it does not fit in buf. */
+int telemetry_encode(char *buf, size_t len, const am2320_measurement *measurement,
+                     const char *time);
+
+#endif
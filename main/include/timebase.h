@@ -0,0 +1,29 @@
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include "esp_err.h"
+
+/* Monotonic timestamp in microseconds since boot (esp_timer). Cheap to
+   take, so samples are stamped with this and only converted to wall
+   clock time when they are encoded. */
+typedef int64_t timebase_stamp_t;
+
+timebase_stamp_t timebase_now();
+
+/* Records an SNTP sync and updates the drift estimate. Returns the sync
+   interval in milliseconds that should be used until the next sync. */
+uint32_t timebase_record_sync(const struct timeval *tv);
+
+/* Converts a monotonic stamp to drift-corrected epoch time. Returns
+   ESP_ERR_INVALID_STATE until the first SNTP sync has happened. Stamps
+   taken before that sync are backfilled from the same model. */
+esp_err_t timebase_to_epoch(timebase_stamp_t stamp, struct timeval *out);
+
+/* Formats a stamp as UTC "%FT%T" into buf. Same errors as
+   timebase_to_epoch, or ESP_FAIL if formatting fails. */
+esp_err_t timebase_format(timebase_stamp_t stamp, char *buf, size_t len);
+
+#endif
@@ -1,3 +1,4 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -10,17 +11,104 @@
 #include "update.h"
 #include "mqtt.h"
 #include "certificates.h"
-#include "cJSON.h"
 #include "json.h"
 #include "am2320.h"
 #include "sntp.h"
+#include "timebase.h"
+#include "history.h"
+#include "http_server.h"
+#include "telemetry.h"
+#include "perf.h"
 #include "esp_wifi.h"
+#include "esp_system.h"
 
 
 static const char *TAG = "main";
 
-extern const uint8_t ca_cert_pem_start[] asm("_binary_ca_pem_start");
-extern const uint8_t ca_cert_pem_end[] asm("_binary_ca_pem_end");
+/* Samples waiting for the wall clock. Until the first SNTP sync they
+   queue up here and are backfilled once the time is known. */
+#define PENDING_SAMPLES 64
+
+typedef struct {
+  timebase_stamp_t stamp;
+  am2320_measurement measurement;
+} sample;
+
+/* Samples between perf reports when CONFIG_PERF_INSTRUMENTATION is set. */
+#define PERF_REPORT_INTERVAL 20
+
+PERF_COUNTER(sensor_measure);
+PERF_COUNTER(sample_encode);
+PERF_COUNTER(mqtt_publish);
+
+static sample pending[PENDING_SAMPLES];
+static int pending_head = 0;
+static int pending_count = 0;
+
+static void
+queue_sample(const sample *s)
+{
+  if (pending_count == PENDING_SAMPLES) {
+    ESP_LOGW(TAG, "Sample queue full, dropping oldest sample");
+    pending_head = (pending_head + 1) % PENDING_SAMPLES;
+    pending_count--;
+  }
+  pending[(pending_head + pending_count) % PENDING_SAMPLES] = *s;
+  pending_count++;
+}
+
+static esp_err_t
+publish_sample(esp_mqtt_client_handle_t mqtt_client, const sample *s)
+{
+  char strftime_buf[32];
+  char payload[128];
+  esp_err_t err;
+
+  PERF_BEGIN(sample_encode);
+  err = timebase_format(s->stamp, strftime_buf, sizeof(strftime_buf));
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  int len = telemetry_encode(payload, sizeof(payload), &s->measurement, strftime_buf);
+  if (len < 0) {
+    ESP_LOGE(TAG, "Telemetry payload too large");
+    return ESP_FAIL;
+  }
+  PERF_END(sample_encode);
+
+  PERF_BEGIN(mqtt_publish);
+  esp_mqtt_client_publish(mqtt_client, "topic/temperature", payload, len, 1, 0);
+  PERF_END(mqtt_publish);
+  return ESP_OK;
+}
+
+#ifdef PERF_ENABLED
+static void
+report_perf()
+{
+  printf("PERF {\"counters\":");
+  perf_write_json(stdout);
+  printf(",\"free_heap_bytes\":%u,\"min_free_heap_bytes\":%u}\n",
+         (unsigned)esp_get_free_heap_size(), (unsigned)esp_get_minimum_free_heap_size());
+}
+#endif
+
+static void
+flush_samples(esp_mqtt_client_handle_t mqtt_client)
+{
+  while (pending_count > 0) {
+    esp_err_t err = publish_sample(mqtt_client, &pending[pending_head]);
+    if (err == ESP_ERR_INVALID_STATE) {
+      ESP_LOGI(TAG, "Time not synced yet, holding %d samples", pending_count);
+      return;
+    } else if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Dropping sample: %s", esp_err_to_name(err));
+    }
+    pending_head = (pending_head + 1) % PENDING_SAMPLES;
+    pending_count--;
+  }
+}
 
 void app_main(void)
 {
@@ -28,6 +116,12 @@ void app_main(void)
   esp_err_t err;
 
   init_cjson();
+
+  err = init_history();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to initialize history: %s", esp_err_to_name(err));
+    return;
+  }
   
   err = setup_global_ca_store();
   if (err != ESP_OK) {
@@ -46,6 +140,12 @@ void app_main(void)
     ESP_LOGE(TAG, "Failed to initialize wifi with smartconfig: %s", esp_err_to_name(err));
     return;
   }    
+
+  err = start_http_server();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to start http server: %s", esp_err_to_name(err));
+    return;
+  }
   
   /* err = start_monitor_update_task("https://192.168.1.19:8700/image.bin"); */
   /* if (err != ESP_OK) { */
@@ -74,40 +174,31 @@ void app_main(void)
   }
 
   esp_wifi_set_ps(WIFI_PS_MAX_MODEM);
+#ifdef PERF_ENABLED
+  unsigned samples_taken = 0;
+#endif
   
   while (1) {
     wait_for_connection(&wifi_info, portMAX_DELAY);
-    am2320_measurement measurement;
-    err = am2320_measure(I2C_NUM_0, GPIO_NUM_21, GPIO_NUM_22, &measurement);
+    sample s;
+    PERF_BEGIN(sensor_measure);
+    err = am2320_measure(I2C_NUM_0, GPIO_NUM_21, GPIO_NUM_22, &s.measurement);
+    PERF_END(sensor_measure);
     if (err != ESP_OK) {
       ESP_LOGE(TAG, "Problem getting AM2320 measurement: %s", esp_err_to_name(err));
       vTaskDelay(pdMS_TO_TICKS(100));
       continue;
     } 
+    s.stamp = timebase_now();
     ESP_LOGI(TAG, "Logging temperature");
-    cJSON *resp = cJSON_CreateObject();
-    cJSON_AddNumberToObject(resp, "temperature", measurement.temperature);
-    cJSON_AddNumberToObject(resp, "relative_humidity", measurement.relative_humidity);
-    time_t now;
-    char strftime_buf[64];
-    struct tm timeinfo;
-    
-    time(&now);
-    if (gmtime_r(&now, &timeinfo) == NULL) {
-      ESP_LOGE(TAG, "Failed to get time: %s", strerror(errno));
-      continue;
-    }
-
-    if (strftime(strftime_buf, sizeof(strftime_buf), "%FT%T", &timeinfo) == 0) {
-      ESP_LOGE(TAG, "Failed to formattime: %s", strerror(errno));
-      continue;
+    history_add(s.stamp, &s.measurement);
+    queue_sample(&s);
+    flush_samples(mqtt_client);
+#ifdef PERF_ENABLED
+    if (++samples_taken % PERF_REPORT_INTERVAL == 0) {
+      report_perf();
     }
-      
-    cJSON_AddStringToObject(resp, "time", strftime_buf);
-    char *out = cJSON_Print(resp);
-    cJSON_free(resp);
-    esp_mqtt_client_publish(mqtt_client, "topic/temperature", out, strlen(out), 1, 0);
-    cJSON_free(out);
+#endif
     vTaskDelay(pdMS_TO_TICKS(30000));
   }
   
@@ -0,0 +1,32 @@
+#include <inttypes.h>
+#include "perf.h"
+
+static perf_counter *counters = NULL;
+static perf_counter **counters_tail = &counters;
+
+void perf_record(perf_counter *counter, perf_cycles_t cycles)
+{
+  if (counter->count == 0) {
+    *counters_tail = counter;
+    counters_tail = &counter->next;
+  }
+  counter->count++;
+  counter->total += cycles;
+  if (cycles > counter->max) {
+    counter->max = cycles;
+  }
+}
+
+void perf_write_json(FILE *out)
+{
+  const char *sep = "";
+  fputc('[', out);
+  for (perf_counter *counter = counters; counter != NULL; counter = counter->next) {
+    fprintf(out, "%s{\"name\":\"%s\",\"count\":%" PRIu32 ",\"cycles_avg\":%" PRIu64
+            ",\"cycles_max\":%" PRIu64 "}",
+            sep, counter->name, counter->count, counter->total / counter->count,
+            (uint64_t)counter->max);
+    sep = ",";
+  }
+  fputc(']', out);
+}
@@ -1,8 +1,16 @@
 #include "esp_sntp.h"
+#include "timebase.h"
+
+static void
+time_sync_notification(struct timeval *tv)
+{
+  sntp_set_sync_interval(timebase_record_sync(tv));
+}
 
 void init_sntp() {
   sntp_setoperatingmode(SNTP_OPMODE_POLL);
   sntp_setservername(0, "pool.ntp.org");
+  sntp_set_time_sync_notification_cb(time_sync_notification);
   sntp_init();
 }
   
@@ -0,0 +1,18 @@
+#include <stdio.h>
+#include "telemetry.h"
+
+/* Formatted directly rather than through cJSON: the payload shape is
+   fixed, and this avoids building a tree on the heap for every sample
+   and printing floats with 17 significant digits. The sensor only has
+   a resolution of 0.1. */
+int telemetry_encode(char *buf, size_t len, const am2320_measurement *measurement,
+                     const char *time)
+{
+  int n = snprintf(buf, len,
+                   "{\"temperature\":%.1f,\"relative_humidity\":%.1f,\"time\":\"%s\"}",
+                   measurement->temperature, measurement->relative_humidity, time);
+  if (n < 0 || (size_t)n >= len) {
+    return -1;
+  }
+  return n;
+}
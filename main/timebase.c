@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "timebase.h"
+
+#define SYNC_INTERVAL_MIN_MS (15U * 60U * 1000U)
+#define SYNC_INTERVAL_MAX_MS (24U * 60U * 60U * 1000U)
+/* Widen the interval when the model predicted the synced time within
+   this many microseconds, narrow it when it was off by more than the
+   upper bound. */
+#define SYNC_WIDEN_ERROR_US 100000LL
+#define SYNC_NARROW_ERROR_US 500000LL
+
+static const char *TAG = "timebase";
+
+static portMUX_TYPE timebase_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct {
+  bool synced;
+  bool has_drift;
+  timebase_stamp_t sync_stamp;
+  int64_t sync_epoch_us;
+  /* Drift of the monotonic counter relative to NTP, parts per billion. */
+  int64_t drift_ppb;
+  uint32_t interval_ms;
+} timebase = {
+  .interval_ms = SYNC_INTERVAL_MIN_MS
+};
+
+static int64_t
+corrected_elapsed_us(int64_t elapsed_us, int64_t drift_ppb)
+{
+  return elapsed_us + elapsed_us * drift_ppb / 1000000000LL;
+}
+
+timebase_stamp_t
+timebase_now()
+{
+  return esp_timer_get_time();
+}
+
+uint32_t
+timebase_record_sync(const struct timeval *tv)
+{
+  timebase_stamp_t stamp = timebase_now();
+  int64_t epoch_us = (int64_t)tv->tv_sec * 1000000LL + tv->tv_usec;
+  int64_t error_us = 0;
+  int64_t drift_ppb;
+  bool had_sync;
+  uint32_t interval_ms;
+
+  portENTER_CRITICAL(&timebase_lock);
+  had_sync = timebase.synced;
+  if (had_sync) {
+    int64_t elapsed_us = stamp - timebase.sync_stamp;
+    int64_t predicted_us = timebase.sync_epoch_us
+      + corrected_elapsed_us(elapsed_us, timebase.drift_ppb);
+    error_us = epoch_us - predicted_us;
+
+    if (elapsed_us > 0) {
+      int64_t measured_ppb =
+        (epoch_us - timebase.sync_epoch_us - elapsed_us) * 1000000000LL / elapsed_us;
+      /* First measurement is taken as is, later ones are smoothed so a
+         single noisy NTP response does not swing the estimate. */
+      if (!timebase.has_drift) {
+        timebase.drift_ppb = measured_ppb;
+        timebase.has_drift = true;
+      } else {
+        timebase.drift_ppb = (3 * timebase.drift_ppb + measured_ppb) / 4;
+      }
+    }
+
+    if (llabs(error_us) < SYNC_WIDEN_ERROR_US) {
+      timebase.interval_ms = timebase.interval_ms >= SYNC_INTERVAL_MAX_MS / 2
+        ? SYNC_INTERVAL_MAX_MS : timebase.interval_ms * 2;
+    } else if (llabs(error_us) > SYNC_NARROW_ERROR_US) {
+      timebase.interval_ms = timebase.interval_ms <= SYNC_INTERVAL_MIN_MS * 2
+        ? SYNC_INTERVAL_MIN_MS : timebase.interval_ms / 2;
+    }
+  }
+  timebase.synced = true;
+  timebase.sync_stamp = stamp;
+  timebase.sync_epoch_us = epoch_us;
+  interval_ms = timebase.interval_ms;
+  drift_ppb = timebase.drift_ppb;
+  portEXIT_CRITICAL(&timebase_lock);
+
+  if (had_sync) {
+    ESP_LOGI(TAG, "Synced, error %lld us, drift %lld ppb, next sync in %u s",
+             (long long)error_us, (long long)drift_ppb, (unsigned)(interval_ms / 1000));
+  } else {
+    ESP_LOGI(TAG, "First sync, next sync in %u s", (unsigned)(interval_ms / 1000));
+  }
+  return interval_ms;
+}
+
+esp_err_t
+timebase_to_epoch(timebase_stamp_t stamp, struct timeval *out)
+{
+  int64_t epoch_us;
+
+  portENTER_CRITICAL(&timebase_lock);
+  if (!timebase.synced) {
+    portEXIT_CRITICAL(&timebase_lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  epoch_us = timebase.sync_epoch_us
+    + corrected_elapsed_us(stamp - timebase.sync_stamp, timebase.drift_ppb);
+  portEXIT_CRITICAL(&timebase_lock);
+
+  out->tv_sec = epoch_us / 1000000LL;
+  out->tv_usec = epoch_us % 1000000LL;
+  return ESP_OK;
+}
+
+esp_err_t
+timebase_format(timebase_stamp_t stamp, char *buf, size_t len)
+{
+  struct timeval tv;
+  struct tm timeinfo;
+  esp_err_t err;
+
+  err = timebase_to_epoch(stamp, &tv);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  if (gmtime_r(&tv.tv_sec, &timeinfo) == NULL) {
+    return ESP_FAIL;
+  }
+
+  if (strftime(buf, len, "%FT%T", &timeinfo) == 0) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
@@ -7,15 +7,12 @@
 
 static const char *TAG = "ota_update";
 
-extern const uint8_t ca_cert_pem_start[] asm("_binary_ca_pem_start");
-extern const uint8_t ca_cert_pem_end[] asm("_binary_ca_pem_end");
-
 static esp_err_t update_firmware(char *url)
 {
   esp_err_t err;
   esp_http_client_config_t config = {
     .url = url,
-    .cert_pem = (char *)ca_cert_pem_start,
+    .use_global_ca_store = true,
     .event_handler = NULL,
     .skip_cert_common_name_check = true
   };
@@ -9,6 +9,10 @@
 #include "wifi_provisioning/manager.h"
 #include "wifi_provisioning/scheme_ble.h"
 #include "esp_wifi_types.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "nvs.h"
+#include "conn_manager.h"
 
 
 static const char *TAG = "Wifi";
@@ -21,6 +25,16 @@ static const int PROVISIONING_ACTIVE = BIT1;
 static const int GOT_IP_BIT = BIT2;
 static const int RERUN_PROVISIONING_BIT = BIT4;
 
+#define MAX_SCAN_RESULTS 16
+#define FAST_SCAN_DWELL_MS 60
+/* How soon to retry handing a backoff expiry to a full event queue. */
+#define TIMER_POST_RETRY_MS 100
+
+ESP_EVENT_DEFINE_BASE(CONN_MANAGER_EVENT);
+
+static conn_manager connection;
+static esp_timer_handle_t backoff_timer = NULL;
+
 static esp_err_t
 reset_ssid() {
   wifi_config_t wifi_cfg;
@@ -123,18 +137,166 @@ start_wifi_provisioning(WifiInfo *wifi_info) {
 }
 
 static void
-try_to_initialize_wifi_unless_connected(void *param)
+save_access_points()
 {
-  WifiInfo *wifi_info = (WifiInfo *) param;
-  while (1) {
-    vTaskDelay(pdMS_TO_TICKS(60000));
-    EventBits_t uxBits = xEventGroupGetBits(wifi_info->event_group);
-    if (uxBits & CONNECTED_BIT) {
-      continue;
+  nvs_handle_t handle;
+  esp_err_t err = nvs_open("conn_manager", NVS_READWRITE, &handle);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to open access point storage: %s", esp_err_to_name(err));
+    return;
+  }
+  err = nvs_set_blob(handle, "aps", connection.aps,
+                     connection.num_aps * sizeof(conn_manager_ap));
+  if (err == ESP_OK) {
+    err = nvs_commit(handle);
+  }
+  if (err == ESP_OK) {
+    connection.dirty = false;
+  } else {
+    /* Left dirty, so the next event that saves tries again. */
+    ESP_LOGE(TAG, "Failed to save access points: %s", esp_err_to_name(err));
+  }
+  nvs_close(handle);
+}
+
+static void
+load_access_points()
+{
+  nvs_handle_t handle;
+  size_t len = sizeof(connection.aps);
+  wifi_config_t wifi_cfg;
+
+  if (nvs_open("conn_manager", NVS_READONLY, &handle) == ESP_OK) {
+    if (nvs_get_blob(handle, "aps", connection.aps, &len) == ESP_OK) {
+      connection.num_aps = len / sizeof(conn_manager_ap);
+    }
+    nvs_close(handle);
+  }
+
+  /* Credentials provisioned before the connection manager existed only
+     live in the wifi driver's own config. */
+  if (connection.num_aps == 0
+      && esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_cfg) == ESP_OK
+      && wifi_cfg.sta.ssid[0] != '\0') {
+    conn_manager_add_ap(&connection, (char *)wifi_cfg.sta.ssid, (char *)wifi_cfg.sta.password);
+    save_access_points();
+  }
+  ESP_LOGI(TAG, "%d access points provisioned", connection.num_aps);
+}
+
+static esp_err_t
+perform_action(const conn_manager_action *action)
+{
+  esp_err_t err = ESP_OK;
+
+  switch (action->type) {
+  case CONN_MANAGER_ACTION_NONE:
+    break;
+  case CONN_MANAGER_ACTION_SCAN: {
+    wifi_scan_config_t scan_cfg = {
+      .channel = action->channel,
+      .scan_type = WIFI_SCAN_TYPE_ACTIVE
+    };
+    if (action->channel != 0) {
+      scan_cfg.scan_time.active.min = FAST_SCAN_DWELL_MS / 2;
+      scan_cfg.scan_time.active.max = FAST_SCAN_DWELL_MS;
+    }
+    ESP_LOGI(TAG, "Scanning channel %d", action->channel);
+    err = esp_wifi_scan_start(&scan_cfg, false);
+    break;
+  }
+  case CONN_MANAGER_ACTION_CONNECT: {
+    const conn_manager_ap *ap = &connection.aps[action->ap];
+    wifi_config_t wifi_cfg = { 0 };
+    strlcpy((char *)wifi_cfg.sta.ssid, ap->ssid, sizeof(wifi_cfg.sta.ssid));
+    strlcpy((char *)wifi_cfg.sta.password, ap->password, sizeof(wifi_cfg.sta.password));
+    wifi_cfg.sta.channel = ap->channel;
+    if (ap->bssid_known) {
+      wifi_cfg.sta.bssid_set = true;
+      memcpy(wifi_cfg.sta.bssid, ap->bssid, sizeof(wifi_cfg.sta.bssid));
+    }
+    ESP_LOGI(TAG, "Connecting to %s on channel %d", ap->ssid, ap->channel);
+    err = esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_cfg);
+    if (err == ESP_OK) {
+      err = esp_wifi_connect();
+    }
+    break;
+  }
+  case CONN_MANAGER_ACTION_WAIT:
+    ESP_LOGI(TAG, "Retrying wifi in %u ms", (unsigned)action->delay_ms);
+    err = esp_timer_start_once(backoff_timer, (uint64_t)action->delay_ms * 1000);
+    break;
+  }
+  return err;
+}
+
+/* Runs an event through the connection manager and carries out the
+   resulting action. If the action cannot even be started, that is fed
+   back as the failure the manager would otherwise have seen. */
+static void
+dispatch(conn_manager_event *event)
+{
+  conn_manager_action action = conn_manager_handle(&connection, event);
+  while (perform_action(&action) != ESP_OK) {
+    conn_manager_event failure = {
+      .now_ms = event->now_ms
+    };
+    if (action.type == CONN_MANAGER_ACTION_SCAN) {
+      failure.type = CONN_MANAGER_EVENT_SCAN_FAILED;
+    } else if (action.type == CONN_MANAGER_ACTION_CONNECT) {
+      failure.type = CONN_MANAGER_EVENT_DISCONNECTED;
+    } else {
+      ESP_LOGE(TAG, "Failed to schedule wifi retry");
+      return;
     }
+    action = conn_manager_handle(&connection, &failure);
+  }
+}
+
+/* The buffers are about 2 KB together, too much for the event task's
+   stack, and only the event task ever gets here. */
+static void
+dispatch_scan_done(uint32_t now_ms)
+{
+  static wifi_ap_record_t records[MAX_SCAN_RESULTS];
+  static conn_manager_scan_result results[MAX_SCAN_RESULTS];
+  uint16_t num = MAX_SCAN_RESULTS;
+
+  if (esp_wifi_scan_get_ap_records(&num, records) != ESP_OK) {
+    num = 0;
+  }
+  for (int i = 0; i < num; i++) {
+    strlcpy(results[i].ssid, (char *)records[i].ssid, sizeof(results[i].ssid));
+    memcpy(results[i].bssid, records[i].bssid, sizeof(results[i].bssid));
+    results[i].channel = records[i].primary;
+    results[i].rssi = records[i].rssi;
+  }
+
+  conn_manager_event event = {
+    .type = CONN_MANAGER_EVENT_SCAN_DONE,
+    .now_ms = now_ms,
+    .results = results,
+    .num_results = num
+  };
+  dispatch(&event);
+}
 
-    esp_wifi_connect();
-  } 
+/* Runs in the esp_timer task, so only hand the expiry over to the
+   event loop where all connection manager events are handled. Blocking
+   here would stall every other timer, so if the event queue is full the
+   timer is re-armed instead; losing the expiry would leave the manager
+   in backoff with nothing left to wake it. */
+static void
+backoff_timer_callback(void *arg)
+{
+  esp_err_t err = esp_event_post(CONN_MANAGER_EVENT, CONN_MANAGER_EVENT_TIMER, NULL, 0, 0);
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to post wifi retry: %s", esp_err_to_name(err));
+    err = esp_timer_start_once(backoff_timer, TIMER_POST_RETRY_MS * 1000);
+    if (err != ESP_OK) {
+      ESP_LOGE(TAG, "Failed to re-arm wifi retry: %s", esp_err_to_name(err));
+    }
+  }
 }
 
 esp_err_t wait_for_connection(WifiInfo *wifi_info, TickType_t wait_time)
@@ -153,22 +315,50 @@ static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                int32_t event_id, void* event_data)
 {
   WifiInfo *wifi_info = (WifiInfo*) arg;
+  conn_manager_event event = {
+    .now_ms = esp_timer_get_time() / 1000
+  };
   
-  if (event_base == WIFI_PROV_EVENT && event_id == WIFI_PROV_CRED_FAIL) {
+  if (event_base == WIFI_PROV_EVENT && event_id == WIFI_PROV_CRED_RECV) {
+    wifi_sta_config_t *cfg = (wifi_sta_config_t *)event_data;
+    if (conn_manager_add_ap(&connection, (char *)cfg->ssid, (char *)cfg->password)
+        && connection.dirty) {
+      save_access_points();
+    }
+  } else if (event_base == WIFI_PROV_EVENT && event_id == WIFI_PROV_CRED_FAIL) {
     xEventGroupClearBits(wifi_info->event_group, CONNECTED_BIT | GOT_IP_BIT);
     wifi_err_reason_t *reason = (void*)event_data;
     if (*reason == WIFI_REASON_AUTH_FAIL) {
       xEventGroupSetBits(wifi_info->event_group, RERUN_PROVISIONING_BIT);
       start_wifi_provisioning(wifi_info);
-    } else {
-      esp_wifi_connect();
+    }
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
+    event.type = CONN_MANAGER_EVENT_START;
+    dispatch(&event);
+  } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_SCAN_DONE) {
+    if (connection.state == CONN_MANAGER_SCANNING) {
+      dispatch_scan_done(event.now_ms);
     }
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
     xEventGroupClearBits(wifi_info->event_group, CONNECTED_BIT | GOT_IP_BIT);
+    event.type = CONN_MANAGER_EVENT_DISCONNECTED;
+    dispatch(&event);
   } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
     xEventGroupSetBits(wifi_info->event_group, CONNECTED_BIT);
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     xEventGroupSetBits(wifi_info->event_group, GOT_IP_BIT);
+    uint32_t reconnects = connection.reconnects;
+    event.type = CONN_MANAGER_EVENT_GOT_IP;
+    dispatch(&event);
+    if (connection.reconnects != reconnects) {
+      ESP_LOGI(TAG, "Reconnected in %u ms", (unsigned)connection.last_reconnect_ms);
+    }
+    if (connection.dirty) {
+      save_access_points();
+    }
+  } else if (event_base == CONN_MANAGER_EVENT && event_id == CONN_MANAGER_EVENT_TIMER) {
+    event.type = CONN_MANAGER_EVENT_TIMER;
+    dispatch(&event);
   }
 }
 
@@ -233,6 +423,26 @@ esp_err_t initialize_wifi_with_provisioning(WifiInfo *wifi_info)
     goto cleanup;
   }
 
+  conn_manager_init(&connection, esp_random());
+  load_access_points();
+
+  const esp_timer_create_args_t timer_args = {
+    .callback = backoff_timer_callback,
+    .name = "wifi_backoff"
+  };
+  err = esp_timer_create(&timer_args, &backoff_timer);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to create wifi backoff timer: %s", esp_err_to_name(err));
+    goto cleanup;
+  }
+
+  err = esp_event_handler_register(CONN_MANAGER_EVENT, ESP_EVENT_ANY_ID,
+                                   &wifi_event_handler, wifi_info);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to register connection manager handler: %s", esp_err_to_name(err));
+    goto cleanup;
+  }
+
   err = esp_event_handler_register(WIFI_EVENT, ESP_EVENT_ANY_ID,
                                    &wifi_event_handler, wifi_info);
   if (err != ESP_OK) {
@@ -256,12 +466,6 @@ esp_err_t initialize_wifi_with_provisioning(WifiInfo *wifi_info)
 
   ESP_LOGI(TAG, "Starting wifi provisioning");
   start_wifi_provisioning(wifi_info);
-  BaseType_t rtos_err = xTaskCreate(try_to_initialize_wifi_unless_connected, "maintain_wifi",
-                                    4096, wifi_info, 1, NULL);
-  if (rtos_err != pdPASS) {
-    ESP_LOGE(TAG, "Failed to start wifi maintenance task");
-  }
-
 
   return ESP_OK;
   
@@ -278,6 +482,12 @@ esp_err_t initialize_wifi_with_provisioning(WifiInfo *wifi_info)
     vSemaphoreDelete(wifi_info->wifi_semaphore);
   }
 
+  if (backoff_timer != NULL) {
+    esp_timer_delete(backoff_timer);
+    backoff_timer = NULL;
+  }
+
+  esp_event_handler_unregister(CONN_MANAGER_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler);
   esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, &wifi_event_handler);
   esp_event_handler_unregister(SC_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler);
   esp_event_handler_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, &wifi_event_handler);
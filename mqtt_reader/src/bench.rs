@@ -0,0 +1,165 @@
+// Compares the SQLite events table against columnar segments for
+// storage size and full scan throughput on synthetic sensor data.
+
+use std::fs;
+use std::os::unix::fs::MetadataExt;
+use std::path::Path;
+use std::time::Instant;
+
+use crate::columnar::{self, Reading, SegmentBuilder, SEGMENT_MAX_READINGS};
+
+const DEVICE: &str = "topic/temperature";
+
+struct Generator {
+    state: u64,
+    reading: Reading,
+}
+
+impl Generator {
+    fn new() -> Generator {
+        Generator {
+            state: 0x2545F4914F6CDD1D,
+            reading: Reading { time: 1_600_000_000, temperature: 21.0, relative_humidity: 45.0 },
+        }
+    }
+
+    fn random(&mut self) -> u64 {
+        self.state ^= self.state << 13;
+        self.state ^= self.state >> 7;
+        self.state ^= self.state << 17;
+        self.state
+    }
+
+    // A 30 s cadence with the odd late sample, and values that random
+    // walk in the 0.1 steps the AM2320 reports.
+    fn next(&mut self) -> Reading {
+        let r = self.random();
+        self.reading.time += if r % 20 == 0 { 31 } else { 30 };
+        let step = |value: f64, bits: u64| ((value * 10.0).round() + (bits % 3) as f64 - 1.0) / 10.0;
+        self.reading.temperature = step(self.reading.temperature, r >> 8);
+        self.reading.relative_humidity = step(self.reading.relative_humidity, r >> 16);
+        self.reading
+    }
+}
+
+// Logical and allocated bytes of the files in dir. Segments are small
+// files, so the allocated size, rounded up to whole blocks, is what
+// they really cost on disk.
+fn dir_size(dir: &Path) -> (u64, u64) {
+    fs::read_dir(dir).map(|entries| {
+        entries.filter_map(|e| e.ok()).filter_map(|e| e.metadata().ok())
+            .fold((0, 0), |(len, disk), m| (len + m.len(), disk + m.blocks() * 512))
+    }).unwrap_or((0, 0))
+}
+
+fn bench_sqlite(dir: &Path, n: usize) -> rusqlite::Result<json::JsonValue> {
+    let path = dir.join("bench.sqlite");
+    let mut conn = rusqlite::Connection::open(&path)?;
+    conn.execute(
+        "create table events (
+             id integer primary key,
+             temperature real,
+             relative_humidity real,
+             time text)",
+        rusqlite::NO_PARAMS)?;
+
+    let mut generator = Generator::new();
+    let start = Instant::now();
+    let tx = conn.transaction()?;
+    {
+        let mut stmt = tx.prepare(
+            "insert into events (temperature, relative_humidity, time) values (?1, ?2, ?3)")?;
+        for _ in 0..n {
+            let reading = generator.next();
+            stmt.execute(rusqlite::params![reading.temperature, reading.relative_humidity,
+                                           columnar::format_time(reading.time)])?;
+        }
+    }
+    tx.commit()?;
+    let write_secs = start.elapsed().as_secs_f64();
+
+    let start = Instant::now();
+    let mut stmt = conn.prepare("select temperature, relative_humidity, time from events")?;
+    let mut rows = stmt.query(rusqlite::NO_PARAMS)?;
+    let mut sum = 0.0;
+    while let Some(row) = rows.next()? {
+        let temperature: f64 = row.get(0)?;
+        let time: String = row.get(2)?;
+        sum += temperature + columnar::parse_time(&time).unwrap_or(0) as f64;
+    }
+    let scan_secs = start.elapsed().as_secs_f64();
+
+    let (bytes, disk_bytes) = dir_size(dir);
+    return Ok(json::object!{
+        "store" => "sqlite",
+        "bytes" => bytes,
+        "disk_bytes" => disk_bytes,
+        "write_per_sec" => n as f64 / write_secs,
+        "scan_per_sec" => n as f64 / scan_secs,
+        "checksum" => sum
+    });
+}
+
+fn bench_columnar(dir: &Path, n: usize) -> std::io::Result<json::JsonValue> {
+    let mut generator = Generator::new();
+    let start = Instant::now();
+    let mut builder = SegmentBuilder::new(DEVICE);
+    for _ in 0..n {
+        builder.push(&generator.next());
+        if builder.len() >= SEGMENT_MAX_READINGS {
+            builder.seal(dir)?;
+            builder = SegmentBuilder::new(DEVICE);
+        }
+    }
+    if builder.len() > 0 {
+        builder.seal(dir)?;
+    }
+    let write_secs = start.elapsed().as_secs_f64();
+
+    let start = Instant::now();
+    let mut sum = 0.0;
+    for segment in columnar::open_segments(dir, DEVICE)? {
+        for reading in segment.iter() {
+            sum += reading.temperature + reading.time as f64;
+        }
+    }
+    let scan_secs = start.elapsed().as_secs_f64();
+
+    let (bytes, disk_bytes) = dir_size(dir);
+    return Ok(json::object!{
+        "store" => "columnar",
+        "bytes" => bytes,
+        "disk_bytes" => disk_bytes,
+        "write_per_sec" => n as f64 / write_secs,
+        "scan_per_sec" => n as f64 / scan_secs,
+        "checksum" => sum
+    });
+}
+
+/// Prints one JSON line per store.
+pub fn storage_benchmark(n: usize) {
+    let dir = std::env::temp_dir().join(format!("mqtt_reader_bench_{}", std::process::id()));
+    let sqlite_dir = dir.join("sqlite");
+    let columnar_dir = dir.join("columnar");
+    fs::create_dir_all(&sqlite_dir).expect("Failed to create benchmark directory");
+    fs::create_dir_all(&columnar_dir).expect("Failed to create benchmark directory");
+
+    match bench_sqlite(&sqlite_dir, n) {
+        Ok(mut result) => {
+            result["samples"] = n.into();
+            println!("{}", result.dump());
+        }
+        Err(err) => eprintln!("SQLite benchmark failed: {}", err),
+    }
+    match bench_columnar(&columnar_dir, n) {
+        Ok(mut result) => {
+            result["samples"] = n.into();
+            println!("{}", result.dump());
+        }
+        Err(err) => eprintln!("Columnar benchmark failed: {}", err),
+    }
+
+    if let Err(err) = fs::remove_dir_all(&dir) {
+        eprintln!("Failed to clean up {}: {}", dir.display(), err);
+    }
+}
@@ -0,0 +1,894 @@
+// Append-only columnar storage for readings.
+//
+// Readings are collected per device and sealed into immutable segment
+// files. Inside a segment timestamps are stored as delta-of-delta and
+// the float columns XOR-encoded against the previous value, as in
+// Facebook's Gorilla paper. A steady 30 s sensor then costs a bit per
+// timestamp and a few bytes per float, instead of a SQLite row.
+//
+// Segment file layout, all integers little endian:
+//
+//   magic "TSEG", version u8
+//   device name: u16 length + utf-8 bytes
+//   count u32, first timestamp i64, last timestamp i64
+//   three columns (time, temperature, relative humidity): u32 length + bytes
+//
+// Until a segment is sealed its readings are also appended to a journal
+// file next to the segments, which is replayed on startup, so readings
+// survive restarts before they reach a sealed segment.
+
+use std::collections::HashMap;
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, Read, Write};
+use std::path::{Path, PathBuf};
+use std::time::{Duration, Instant};
+
+use memmap2::Mmap;
+
+const MAGIC: &[u8; 4] = b"TSEG";
+const VERSION: u8 = 1;
+
+pub const SEGMENT_EXTENSION: &str = "seg";
+const JOURNAL_EXTENSION: &str = "open";
+const JOURNAL_RECORD_LEN: usize = 24;
+
+// A segment is sealed when it holds this many readings, or when it has
+// been open this long. At one reading per 30 s a segment fills up after
+// about 34 hours, so the age cap only seals devices that slowed down or
+// stopped sending; the journal keeps the readings safe meanwhile.
+pub const SEGMENT_MAX_READINGS: u32 = 4096;
+const SEGMENT_MAX_AGE: Duration = Duration::from_secs(36 * 3600);
+
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub struct Reading {
+    pub time: i64,
+    pub temperature: f64,
+    pub relative_humidity: f64,
+}
+
+struct BitWriter {
+    bytes: Vec<u8>,
+    used: u32,
+}
+
+impl BitWriter {
+    fn new() -> BitWriter {
+        BitWriter { bytes: Vec::new(), used: 8 }
+    }
+
+    fn write(&mut self, value: u64, bits: u32) {
+        for i in (0..bits).rev() {
+            if self.used == 8 {
+                self.bytes.push(0);
+                self.used = 0;
+            }
+            if (value >> i) & 1 == 1 {
+                *self.bytes.last_mut().unwrap() |= 0x80 >> self.used;
+            }
+            self.used += 1;
+        }
+    }
+}
+
+struct BitReader<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> BitReader<'a> {
+    fn new(bytes: &'a [u8]) -> BitReader<'a> {
+        BitReader { bytes, pos: 0 }
+    }
+
+    fn read(&mut self, bits: u32) -> Option<u64> {
+        let mut value = 0u64;
+        for _ in 0..bits {
+            let byte = *self.bytes.get(self.pos / 8)?;
+            let bit = (byte >> (7 - self.pos % 8)) & 1;
+            value = (value << 1) | bit as u64;
+            self.pos += 1;
+        }
+        Some(value)
+    }
+
+    fn bit(&mut self) -> Option<bool> {
+        self.read(1).map(|b| b == 1)
+    }
+}
+
+fn sign_extend(value: u64, bits: u32) -> i64 {
+    let shift = 64 - bits;
+    ((value << shift) as i64) >> shift
+}
+
+// Delta-of-delta buckets: control bits, control value, payload bits.
+const TIME_BUCKETS: [(u32, u64, u32); 4] = [
+    (2, 0b10, 7),
+    (3, 0b110, 9),
+    (4, 0b1110, 12),
+    (4, 0b1111, 32),
+];
+
+struct TimeEncoder {
+    out: BitWriter,
+    prev: i64,
+    prev_delta: i64,
+    count: u32,
+}
+
+impl TimeEncoder {
+    fn new() -> TimeEncoder {
+        TimeEncoder { out: BitWriter::new(), prev: 0, prev_delta: 0, count: 0 }
+    }
+
+    fn push(&mut self, time: i64) {
+        match self.count {
+            0 => self.out.write(time as u64, 64),
+            1 => {
+                self.prev_delta = time - self.prev;
+                self.out.write(self.prev_delta as u64, 64);
+            }
+            _ => {
+                let delta = time - self.prev;
+                let dod = delta - self.prev_delta;
+                if dod == 0 {
+                    self.out.write(0, 1);
+                } else {
+                    let &(control_bits, control, bits) = TIME_BUCKETS.iter()
+                        .find(|&&(_, _, bits)| {
+                            bits == 32 || (dod >= -(1 << (bits - 1)) && dod < (1 << (bits - 1)))
+                        })
+                        .unwrap();
+                    if bits == 32 && (dod < i32::MIN as i64 || dod > i32::MAX as i64) {
+                        // Gaps this irregular do not happen for a sensor;
+                        // store them exactly anyway.
+                        self.out.write(0b1111, 4);
+                        self.out.write(u32::MAX as u64, 32);
+                        self.out.write(dod as u64, 64);
+                    } else {
+                        self.out.write(control, control_bits);
+                        self.out.write(dod as u64 & ((1u64 << bits) - 1), bits);
+                    }
+                }
+                self.prev_delta = delta;
+            }
+        }
+        self.prev = time;
+        self.count += 1;
+    }
+}
+
+struct TimeDecoder<'a> {
+    input: BitReader<'a>,
+    prev: i64,
+    prev_delta: i64,
+    count: u32,
+}
+
+impl<'a> TimeDecoder<'a> {
+    fn new(bytes: &'a [u8]) -> TimeDecoder<'a> {
+        TimeDecoder { input: BitReader::new(bytes), prev: 0, prev_delta: 0, count: 0 }
+    }
+
+    fn next(&mut self) -> Option<i64> {
+        let time = match self.count {
+            0 => self.input.read(64)? as i64,
+            1 => {
+                self.prev_delta = self.input.read(64)? as i64;
+                self.prev + self.prev_delta
+            }
+            _ => {
+                let mut control_bits = 0;
+                while control_bits < 4 && self.input.bit()? {
+                    control_bits += 1;
+                }
+                let dod = match control_bits {
+                    0 => 0,
+                    4 => {
+                        let raw = self.input.read(32)?;
+                        if raw == u32::MAX as u64 {
+                            self.input.read(64)? as i64
+                        } else {
+                            sign_extend(raw, 32)
+                        }
+                    }
+                    n => {
+                        let bits = TIME_BUCKETS[n - 1].2;
+                        sign_extend(self.input.read(bits)?, bits)
+                    }
+                };
+                self.prev_delta += dod;
+                self.prev + self.prev_delta
+            }
+        };
+        self.prev = time;
+        self.count += 1;
+        Some(time)
+    }
+}
+
+struct FloatEncoder {
+    out: BitWriter,
+    prev: u64,
+    leading: u32,
+    trailing: u32,
+    count: u32,
+}
+
+impl FloatEncoder {
+    fn new() -> FloatEncoder {
+        FloatEncoder { out: BitWriter::new(), prev: 0, leading: u32::MAX, trailing: 0, count: 0 }
+    }
+
+    fn push(&mut self, value: f64) {
+        let bits = value.to_bits();
+        if self.count == 0 {
+            self.out.write(bits, 64);
+        } else {
+            let xor = bits ^ self.prev;
+            if xor == 0 {
+                self.out.write(0, 1);
+            } else {
+                let leading = xor.leading_zeros().min(31);
+                let trailing = xor.trailing_zeros();
+                self.out.write(1, 1);
+                if self.leading != u32::MAX && leading >= self.leading && trailing >= self.trailing {
+                    // Fits the previous window, only write the window.
+                    self.out.write(0, 1);
+                    let meaningful = 64 - self.leading - self.trailing;
+                    self.out.write(xor >> self.trailing, meaningful);
+                } else {
+                    let meaningful = 64 - leading - trailing;
+                    self.out.write(1, 1);
+                    self.out.write(leading as u64, 5);
+                    self.out.write((meaningful & 63) as u64, 6);
+                    self.out.write(xor >> trailing, meaningful);
+                    self.leading = leading;
+                    self.trailing = trailing;
+                }
+            }
+        }
+        self.prev = bits;
+        self.count += 1;
+    }
+}
+
+struct FloatDecoder<'a> {
+    input: BitReader<'a>,
+    prev: u64,
+    leading: u32,
+    trailing: u32,
+    count: u32,
+}
+
+impl<'a> FloatDecoder<'a> {
+    fn new(bytes: &'a [u8]) -> FloatDecoder<'a> {
+        FloatDecoder { input: BitReader::new(bytes), prev: 0, leading: 0, trailing: 0, count: 0 }
+    }
+
+    fn next(&mut self) -> Option<f64> {
+        let bits = if self.count == 0 {
+            self.input.read(64)?
+        } else if !self.input.bit()? {
+            self.prev
+        } else {
+            if self.input.bit()? {
+                self.leading = self.input.read(5)? as u32;
+                let meaningful = match self.input.read(6)? as u32 {
+                    0 => 64,
+                    n => n,
+                };
+                self.trailing = 64 - self.leading - meaningful;
+            }
+            let meaningful = 64 - self.leading - self.trailing;
+            self.prev ^ (self.input.read(meaningful)? << self.trailing)
+        };
+        self.prev = bits;
+        self.count += 1;
+        Some(f64::from_bits(bits))
+    }
+}
+
+/// Accumulates readings for one device until they are sealed into a
+/// segment file.
+pub struct SegmentBuilder {
+    device: String,
+    times: TimeEncoder,
+    temperatures: FloatEncoder,
+    humidities: FloatEncoder,
+    first_time: i64,
+    last_time: i64,
+}
+
+impl SegmentBuilder {
+    pub fn new(device: &str) -> SegmentBuilder {
+        SegmentBuilder {
+            device: device.to_string(),
+            times: TimeEncoder::new(),
+            temperatures: FloatEncoder::new(),
+            humidities: FloatEncoder::new(),
+            first_time: 0,
+            last_time: 0,
+        }
+    }
+
+    pub fn len(&self) -> u32 {
+        self.times.count
+    }
+
+    pub fn push(&mut self, reading: &Reading) {
+        if self.len() == 0 {
+            self.first_time = reading.time;
+        }
+        self.last_time = reading.time;
+        self.times.push(reading.time);
+        self.temperatures.push(reading.temperature);
+        self.humidities.push(reading.relative_humidity);
+    }
+
+    /// Writes the segment into dir. The file is written under a temporary
+    /// name and linked into place, so readers only ever see complete
+    /// segments. An existing segment with the same first timestamp is
+    /// never replaced; the new one gets a numbered name instead.
+    pub fn seal(self, dir: &Path) -> io::Result<PathBuf> {
+        let base = format!("{}-{}", sanitize(&self.device), self.first_time);
+        let tmp_path = dir.join(format!(".{}.{}.tmp", base, SEGMENT_EXTENSION));
+
+        let mut out = Vec::new();
+        out.extend_from_slice(MAGIC);
+        out.push(VERSION);
+        out.extend_from_slice(&(self.device.len() as u16).to_le_bytes());
+        out.extend_from_slice(self.device.as_bytes());
+        out.extend_from_slice(&self.times.count.to_le_bytes());
+        out.extend_from_slice(&self.first_time.to_le_bytes());
+        out.extend_from_slice(&self.last_time.to_le_bytes());
+        for column in &[&self.times.out.bytes, &self.temperatures.out.bytes, &self.humidities.out.bytes] {
+            out.extend_from_slice(&(column.len() as u32).to_le_bytes());
+            out.extend_from_slice(column);
+        }
+
+        let mut file = File::create(&tmp_path)?;
+        file.write_all(&out)?;
+        file.sync_all()?;
+
+        let mut suffix = 0;
+        loop {
+            let name = if suffix == 0 {
+                format!("{}.{}", base, SEGMENT_EXTENSION)
+            } else {
+                format!("{}-{}.{}", base, suffix, SEGMENT_EXTENSION)
+            };
+            let path = dir.join(name);
+            // Unlike rename, hard_link fails if the target exists.
+            match fs::hard_link(&tmp_path, &path) {
+                Ok(()) => {
+                    fs::remove_file(&tmp_path)?;
+                    return Ok(path);
+                }
+                Err(ref err) if err.kind() == io::ErrorKind::AlreadyExists => suffix += 1,
+                Err(err) => return Err(err),
+            }
+        }
+    }
+}
+
+struct OpenSegment {
+    builder: SegmentBuilder,
+    journal: File,
+    journal_path: PathBuf,
+    opened: Instant,
+}
+
+/// Open segments for every device, sealed into dir as they fill up or
+/// age out. Unsealed readings are journaled to disk and replayed by new.
+pub struct SegmentStore {
+    dir: PathBuf,
+    open: HashMap<String, OpenSegment>,
+}
+
+fn journal_path(dir: &Path, device: &str) -> PathBuf {
+    // FNV-1a, so devices that sanitize to the same name still get
+    // separate journals.
+    let hash = device.bytes().fold(0xcbf29ce484222325u64, |h, b| (h ^ b as u64).wrapping_mul(0x100000001b3));
+    dir.join(format!("{}-{:016x}.{}", sanitize(device), hash, JOURNAL_EXTENSION))
+}
+
+fn encode_journal_record(reading: &Reading) -> [u8; JOURNAL_RECORD_LEN] {
+    let mut record = [0u8; JOURNAL_RECORD_LEN];
+    record[0..8].copy_from_slice(&reading.time.to_le_bytes());
+    record[8..16].copy_from_slice(&reading.temperature.to_bits().to_le_bytes());
+    record[16..24].copy_from_slice(&reading.relative_humidity.to_bits().to_le_bytes());
+    record
+}
+
+fn decode_journal_record(record: &[u8]) -> Reading {
+    let mut buf = [0u8; 8];
+    let mut field = |i: usize| {
+        buf.copy_from_slice(&record[i * 8..i * 8 + 8]);
+        u64::from_le_bytes(buf)
+    };
+    Reading {
+        time: field(0) as i64,
+        temperature: f64::from_bits(field(1)),
+        relative_humidity: f64::from_bits(field(2)),
+    }
+}
+
+// Journal layout: u16 device name length, device name, then fixed
+// size records. Returns the device, the readings not yet in a sealed
+// segment, and the length up to the last whole record.
+fn read_journal(dir: &Path, path: &Path) -> io::Result<(String, Vec<Reading>, u64)> {
+    let mut bytes = Vec::new();
+    File::open(path)?.read_to_end(&mut bytes)?;
+    let mut cursor = Cursor { bytes: &bytes, pos: 0 };
+    let device_len = cursor.u16()? as usize;
+    let device = String::from_utf8(cursor.take(device_len)?.to_vec())
+        .map_err(|_| invalid("device name is not utf-8"))?;
+
+    // A crash or failed removal after sealing leaves readings that are
+    // already in a segment.
+    let sealed_until = open_segments(dir, &device)?.iter()
+        .map(|s| s.last_time).max();
+    let records = bytes[cursor.pos..].chunks_exact(JOURNAL_RECORD_LEN);
+    let valid_len = (bytes.len() - records.remainder().len()) as u64;
+    let readings = records
+        .map(decode_journal_record)
+        .filter(|r| sealed_until.map_or(true, |t| r.time > t))
+        .collect();
+    return Ok((device, readings, valid_len));
+}
+
+impl SegmentStore {
+    pub fn new(dir: &Path) -> io::Result<SegmentStore> {
+        fs::create_dir_all(dir)?;
+        let mut store = SegmentStore { dir: dir.to_path_buf(), open: HashMap::new() };
+
+        let mut journals = Vec::new();
+        for entry in fs::read_dir(dir)? {
+            let path = entry?.path();
+            if path.extension().map_or(false, |ext| ext == JOURNAL_EXTENSION) {
+                journals.push(path);
+            }
+        }
+        for path in journals {
+            let (device, _, _) = read_journal(dir, &path)?;
+            if store.open_segment(&device)?.builder.len() == 0 {
+                store.seal(&device)?;
+            }
+        }
+        return Ok(store);
+    }
+
+    // An existing journal, left by a restart or a seal that failed, is
+    // picked up where it ended instead of being replaced, so it is only
+    // removed once its readings are in a sealed segment.
+    fn open_segment(&mut self, device: &str) -> io::Result<&mut OpenSegment> {
+        if !self.open.contains_key(device) {
+            let journal_path = journal_path(&self.dir, device);
+            let mut journal = OpenOptions::new().create(true).append(true).open(&journal_path)?;
+            let mut builder = SegmentBuilder::new(device);
+            if journal.metadata()?.len() == 0 {
+                journal.write_all(&(device.len() as u16).to_le_bytes())?;
+                journal.write_all(device.as_bytes())?;
+            } else {
+                let (_, readings, valid_len) = read_journal(&self.dir, &journal_path)?;
+                // Drop a record cut short by a crash, so new records
+                // stay aligned.
+                journal.set_len(valid_len)?;
+                for reading in &readings {
+                    builder.push(reading);
+                }
+            }
+            self.open.insert(device.to_string(), OpenSegment {
+                builder,
+                journal,
+                journal_path,
+                opened: Instant::now(),
+            });
+        }
+        return Ok(self.open.get_mut(device).unwrap());
+    }
+
+    fn seal(&mut self, device: &str) -> io::Result<()> {
+        if let Some(segment) = self.open.remove(device) {
+            if segment.builder.len() > 0 {
+                segment.builder.seal(&self.dir)?;
+            }
+            fs::remove_file(&segment.journal_path)?;
+        }
+        return Ok(());
+    }
+
+    pub fn push(&mut self, device: &str, reading: &Reading) -> io::Result<()> {
+        let segment = self.open_segment(device)?;
+        segment.journal.write_all(&encode_journal_record(reading))?;
+        segment.builder.push(reading);
+        if segment.builder.len() >= SEGMENT_MAX_READINGS || segment.opened.elapsed() >= SEGMENT_MAX_AGE {
+            self.seal(device)?;
+        }
+        return Ok(());
+    }
+
+    /// Seals segments that have been open too long, also for devices
+    /// that have stopped sending.
+    pub fn seal_expired(&mut self) -> io::Result<()> {
+        let expired = self.open.iter()
+            .filter(|(_, segment)| segment.opened.elapsed() >= SEGMENT_MAX_AGE)
+            .map(|(device, _)| device.clone())
+            .collect::<Vec<_>>();
+        for device in expired {
+            self.seal(&device)?;
+        }
+        return Ok(());
+    }
+
+    pub fn seal_all(&mut self) -> io::Result<()> {
+        let devices = self.open.keys().cloned().collect::<Vec<_>>();
+        for device in devices {
+            self.seal(&device)?;
+        }
+        return Ok(());
+    }
+}
+
+fn sanitize(device: &str) -> String {
+    device.chars()
+        .map(|c| if c.is_ascii_alphanumeric() || c == '_' { c } else { '_' })
+        .collect()
+}
+
+/// A sealed segment, memory mapped for scanning.
+pub struct Segment {
+    map: Mmap,
+    pub device: String,
+    pub count: u32,
+    pub first_time: i64,
+    pub last_time: i64,
+    columns: [(usize, usize); 3],
+}
+
+fn invalid(msg: &str) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, msg.to_string())
+}
+
+struct Cursor<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+}
+
+impl<'a> Cursor<'a> {
+    fn take(&mut self, n: usize) -> io::Result<&'a [u8]> {
+        if self.bytes.len() - self.pos < n {
+            return Err(invalid("truncated segment"));
+        }
+        let slice = &self.bytes[self.pos..self.pos + n];
+        self.pos += n;
+        return Ok(slice);
+    }
+
+    fn u16(&mut self) -> io::Result<u16> {
+        let mut buf = [0u8; 2];
+        buf.copy_from_slice(self.take(2)?);
+        return Ok(u16::from_le_bytes(buf));
+    }
+
+    fn u32(&mut self) -> io::Result<u32> {
+        let mut buf = [0u8; 4];
+        buf.copy_from_slice(self.take(4)?);
+        return Ok(u32::from_le_bytes(buf));
+    }
+
+    fn i64(&mut self) -> io::Result<i64> {
+        let mut buf = [0u8; 8];
+        buf.copy_from_slice(self.take(8)?);
+        return Ok(i64::from_le_bytes(buf));
+    }
+}
+
+impl Segment {
+    pub fn open(path: &Path) -> io::Result<Segment> {
+        let file = File::open(path)?;
+        // Segments are immutable once renamed into place.
+        let map = unsafe { Mmap::map(&file)? };
+
+        let mut cursor = Cursor { bytes: &map[..], pos: 0 };
+        if cursor.take(4)? != MAGIC || cursor.take(1)?[0] != VERSION {
+            return Err(invalid("not a segment file"));
+        }
+        let device_len = cursor.u16()? as usize;
+        let device = String::from_utf8(cursor.take(device_len)?.to_vec())
+            .map_err(|_| invalid("device name is not utf-8"))?;
+        let count = cursor.u32()?;
+        let first_time = cursor.i64()?;
+        let last_time = cursor.i64()?;
+        let mut columns = [(0, 0); 3];
+        for column in columns.iter_mut() {
+            let len = cursor.u32()? as usize;
+            let start = cursor.pos;
+            cursor.take(len)?;
+            *column = (start, start + len);
+        }
+
+        return Ok(Segment { map, device, count, first_time, last_time, columns });
+    }
+
+    fn column(&self, i: usize) -> &[u8] {
+        let (start, end) = self.columns[i];
+        &self.map[start..end]
+    }
+
+    pub fn iter(&self) -> SegmentIter<'_> {
+        SegmentIter {
+            times: TimeDecoder::new(self.column(0)),
+            temperatures: FloatDecoder::new(self.column(1)),
+            humidities: FloatDecoder::new(self.column(2)),
+            remaining: self.count,
+        }
+    }
+}
+
+pub struct SegmentIter<'a> {
+    times: TimeDecoder<'a>,
+    temperatures: FloatDecoder<'a>,
+    humidities: FloatDecoder<'a>,
+    remaining: u32,
+}
+
+impl<'a> Iterator for SegmentIter<'a> {
+    type Item = Reading;
+
+    fn next(&mut self) -> Option<Reading> {
+        if self.remaining == 0 {
+            return None;
+        }
+        self.remaining -= 1;
+        Some(Reading {
+            time: self.times.next()?,
+            temperature: self.temperatures.next()?,
+            relative_humidity: self.humidities.next()?,
+        })
+    }
+}
+
+/// Opens all segments in dir for device, oldest first.
+pub fn open_segments(dir: &Path, device: &str) -> io::Result<Vec<Segment>> {
+    let prefix = format!("{}-", sanitize(device));
+    let mut segments = Vec::new();
+    for entry in fs::read_dir(dir)? {
+        let path = entry?.path();
+        let matches = path.extension().map_or(false, |ext| ext == SEGMENT_EXTENSION)
+            && path.file_name().and_then(|n| n.to_str()).map_or(false, |n| n.starts_with(&prefix));
+        if !matches {
+            continue;
+        }
+        let segment = Segment::open(&path)?;
+        if segment.device == device {
+            segments.push(segment);
+        }
+    }
+    segments.sort_by_key(|s| s.first_time);
+    return Ok(segments);
+}
+
+/// Writes every reading for device as CSV.
+pub fn export_csv<W: Write>(dir: &Path, device: &str, out: &mut W) -> io::Result<()> {
+    writeln!(out, "time,temperature,relative_humidity")?;
+    for segment in open_segments(dir, device)? {
+        for reading in segment.iter() {
+            writeln!(out, "{},{},{}", format_time(reading.time),
+                     reading.temperature, reading.relative_humidity)?;
+        }
+    }
+    return Ok(());
+}
+
+// Days since 1970-01-01 to and from a civil date, after Howard
+// Hinnant's chrono-compatible algorithms.
+fn days_from_civil(y: i64, m: i64, d: i64) -> i64 {
+    let y = if m <= 2 { y - 1 } else { y };
+    let era = if y >= 0 { y } else { y - 399 } / 400;
+    let yoe = y - era * 400;
+    let doy = (153 * (if m > 2 { m - 3 } else { m + 9 }) + 2) / 5 + d - 1;
+    let doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    era * 146097 + doe - 719468
+}
+
+fn civil_from_days(z: i64) -> (i64, i64, i64) {
+    let z = z + 719468;
+    let era = if z >= 0 { z } else { z - 146096 } / 146097;
+    let doe = z - era * 146097;
+    let yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    let doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    let mp = (5 * doy + 2) / 153;
+    let d = doy - (153 * mp + 2) / 5 + 1;
+    let m = if mp < 10 { mp + 3 } else { mp - 9 };
+    (if m <= 2 { yoe + era * 400 + 1 } else { yoe + era * 400 }, m, d)
+}
+
+/// Parses the "%FT%T" UTC timestamps the sensor publishes.
+pub fn parse_time(s: &str) -> Option<i64> {
+    let b = s.as_bytes();
+    if b.len() != 19 || !s.is_ascii()
+        || b[4] != b'-' || b[7] != b'-' || b[10] != b'T' || b[13] != b':' || b[16] != b':' {
+        return None;
+    }
+    let field = |range: std::ops::Range<usize>| -> Option<i64> {
+        let digits = &b[range];
+        if !digits.iter().all(u8::is_ascii_digit) {
+            return None;
+        }
+        digits.iter().fold(Some(0), |acc, d| acc.map(|v| v * 10 + (d - b'0') as i64))
+    };
+    let days = days_from_civil(field(0..4)?, field(5..7)?, field(8..10)?);
+    return Some(days * 86400 + field(11..13)? * 3600 + field(14..16)? * 60 + field(17..19)?);
+}
+
+pub fn format_time(time: i64) -> String {
+    let (y, m, d) = civil_from_days(time.div_euclid(86400));
+    let secs = time.rem_euclid(86400);
+    format!("{:04}-{:02}-{:02}T{:02}:{:02}:{:02}", y, m, d, secs / 3600, secs / 60 % 60, secs % 60)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir = std::env::temp_dir()
+            .join(format!("columnar-{}-{}", name, std::process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        fs::create_dir_all(&dir).unwrap();
+        dir
+    }
+
+    fn round_trip(dir: &Path, readings: &[Reading]) -> Vec<Reading> {
+        let mut builder = SegmentBuilder::new("sensor");
+        for reading in readings {
+            builder.push(reading);
+        }
+        let path = builder.seal(dir).unwrap();
+        Segment::open(&path).unwrap().iter().collect()
+    }
+
+    fn same_bits(a: &[Reading], b: &[Reading]) -> bool {
+        a.len() == b.len() && a.iter().zip(b).all(|(x, y)| {
+            x.time == y.time
+                && x.temperature.to_bits() == y.temperature.to_bits()
+                && x.relative_humidity.to_bits() == y.relative_humidity.to_bits()
+        })
+    }
+
+    #[test]
+    fn round_trips_time_gaps() {
+        let dir = temp_dir("gaps");
+        let gaps = [30, 30, 31, 29, 30, -5, 0, 100, -100, 1000, -3000, 86400,
+                    1 << 31, -(1 << 40), i32::MAX as i64 + 1, i32::MIN as i64 - 1,
+                    30, 30, 1 << 50, 30];
+        let mut time = -1_000_000;
+        let readings = gaps.iter().map(|gap| {
+            time += gap;
+            Reading { time, temperature: 20.0, relative_humidity: 40.0 }
+        }).collect::<Vec<_>>();
+        assert!(same_bits(&round_trip(&dir, &readings), &readings));
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn round_trips_special_and_random_floats() {
+        let dir = temp_dir("floats");
+        let mut state = 0x9E3779B97F4A7C15u64;
+        let mut values = vec![0.0, -0.0, f64::NAN, -f64::NAN, f64::INFINITY,
+                              f64::NEG_INFINITY, f64::MIN_POSITIVE, f64::MAX, 21.3, 21.3, 21.4];
+        for _ in 0..500 {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            values.push(f64::from_bits(state));
+        }
+        let readings = values.iter().enumerate().map(|(i, &v)| Reading {
+            time: i as i64 * 30,
+            temperature: v,
+            relative_humidity: values[values.len() - 1 - i],
+        }).collect::<Vec<_>>();
+        assert!(same_bits(&round_trip(&dir, &readings), &readings));
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn rejects_truncated_segment() {
+        let dir = temp_dir("truncated");
+        let mut builder = SegmentBuilder::new("sensor");
+        for i in 0..100 {
+            builder.push(&Reading { time: i * 30, temperature: 20.0 + i as f64, relative_humidity: 40.0 });
+        }
+        let path = builder.seal(&dir).unwrap();
+        let len = fs::metadata(&path).unwrap().len();
+        OpenOptions::new().write(true).open(&path).unwrap().set_len(len - 3).unwrap();
+        let err = Segment::open(&path).err().unwrap();
+        assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn never_overwrites_sealed_segment() {
+        let dir = temp_dir("overwrite");
+        let reading = Reading { time: 1000, temperature: 1.0, relative_humidity: 2.0 };
+        let mut first = SegmentBuilder::new("sensor");
+        first.push(&reading);
+        let mut second = SegmentBuilder::new("sensor");
+        second.push(&Reading { temperature: 3.0, ..reading });
+        let first_path = first.seal(&dir).unwrap();
+        let second_path = second.seal(&dir).unwrap();
+        assert_ne!(first_path, second_path);
+        assert_eq!(Segment::open(&first_path).unwrap().iter().next().unwrap().temperature, 1.0);
+        assert_eq!(open_segments(&dir, "sensor").unwrap().len(), 2);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn replays_unsealed_readings() {
+        let dir = temp_dir("journal");
+        let readings = (0..10).map(|i| Reading {
+            time: 1000 + i * 30, temperature: i as f64, relative_humidity: 50.0
+        }).collect::<Vec<_>>();
+        {
+            let mut store = SegmentStore::new(&dir).unwrap();
+            for reading in &readings {
+                store.push("topic/temperature", reading).unwrap();
+            }
+            // Dropped without sealing, as on a crash.
+        }
+        let mut store = SegmentStore::new(&dir).unwrap();
+        store.seal_all().unwrap();
+        let segments = open_segments(&dir, "topic/temperature").unwrap();
+        assert_eq!(segments.len(), 1);
+        assert_eq!(segments[0].iter().collect::<Vec<_>>(), readings);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn resumes_journal_after_torn_record() {
+        let dir = temp_dir("torn");
+        let readings = (0..6).map(|i| Reading {
+            time: 1000 + i * 30, temperature: i as f64, relative_humidity: 50.0
+        }).collect::<Vec<_>>();
+        {
+            let mut store = SegmentStore::new(&dir).unwrap();
+            for reading in &readings[..3] {
+                store.push("sensor", reading).unwrap();
+            }
+        }
+        let path = journal_path(&dir, "sensor");
+        OpenOptions::new().append(true).open(&path).unwrap().write_all(&[0xff; 5]).unwrap();
+
+        let mut store = SegmentStore::new(&dir).unwrap();
+        for reading in &readings[3..] {
+            store.push("sensor", reading).unwrap();
+        }
+        // Replaying the journal again must neither repeat the header nor
+        // misalign the records appended after the torn one.
+        drop(store);
+        let mut store = SegmentStore::new(&dir).unwrap();
+        store.seal_all().unwrap();
+        assert!(!path.exists());
+        let segments = open_segments(&dir, "sensor").unwrap();
+        assert_eq!(segments.len(), 1);
+        assert_eq!(segments[0].iter().collect::<Vec<_>>(), readings);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn parses_and_formats_time() {
+        assert_eq!(parse_time("1970-01-01T00:00:00"), Some(0));
+        assert_eq!(parse_time("2021-02-28T23:59:59"), Some(1614556799));
+        assert_eq!(format_time(1614556799), "2021-02-28T23:59:59");
+        assert_eq!(format_time(-1), "1969-12-31T23:59:59");
+        for time in &[0, 951782400, 4102444799, -86400 * 365] {
+            assert_eq!(parse_time(&format_time(*time)), Some(*time));
+        }
+        assert_eq!(parse_time("garbage"), None);
+        assert_eq!(parse_time("2020é01-01T00:00:0"), None);
+        assert_eq!(parse_time("2020-01-01 00:00:00"), None);
+        assert_eq!(parse_time("2020-01-01T0+:00:00"), None);
+    }
+}
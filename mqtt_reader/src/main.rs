@@ -2,7 +2,17 @@ use log::{info, error};
 extern crate paho_mqtt as mqtt;
 use std::path::{Path, PathBuf};
 use std::process;
+use std::sync::mpsc;
+use std::time::{Duration, Instant};
 
+mod bench;
+mod columnar;
+
+const SEAL_CHECK_INTERVAL: Duration = Duration::from_secs(60);
+
+fn segments_path() -> &'static Path {
+    Path::new("segments")
+}
 
 fn certificate_collection_path() -> &'static Path {
     Path::new("/home/troels/src/esp32-wifi-updates/certificate-collection/")
@@ -20,6 +30,34 @@ fn keystore_path() -> PathBuf {
 fn main() {
     env_logger::init();
 
+    let args: Vec<String> = std::env::args().collect();
+    match args.get(1).map(|s| s.as_str()) {
+        Some("export") => {
+            let device = args.get(2).map(|s| s.as_str()).unwrap_or("topic/temperature");
+            let stdout = std::io::stdout();
+            if let Err(err) = columnar::export_csv(segments_path(), device, &mut stdout.lock()) {
+                error!("Failed to export segments: {}", err);
+                process::exit(1);
+            }
+        }
+        Some("bench-storage") => {
+            let n = args.get(2).and_then(|s| s.parse().ok()).unwrap_or(10_000_000);
+            bench::storage_benchmark(n);
+        }
+        Some(other) => {
+            error!("Unknown command {}, expected export or bench-storage", other);
+            process::exit(1);
+        }
+        None => read_messages(),
+    }
+}
+
+fn read_messages() {
+    let mut segments = columnar::SegmentStore::new(segments_path()).unwrap_or_else( |err| {
+        error!("Failed to open segment store: {}", err);
+        process::exit(1);
+    });
+
     let conn = rusqlite::Connection::open("db.sqlite").unwrap_or_else( |err| {
         error!("Failed to open sqlite: {}", err);
         process::exit(1);
@@ -72,7 +110,23 @@ fn main() {
     
     info!("Waiting for messages");
 
-    for msg in rx.iter() {
+    let mut last_seal_check = Instant::now();
+    loop {
+        // Wake up now and then even without traffic, and check on every
+        // pass, since one device still sending keeps the receive from
+        // timing out while the segments of quiet devices need sealing.
+        let received = rx.recv_timeout(SEAL_CHECK_INTERVAL);
+        if last_seal_check.elapsed() >= SEAL_CHECK_INTERVAL {
+            last_seal_check = Instant::now();
+            if let Err(err) = segments.seal_expired() {
+                error!("Problems sealing segments: {}", err);
+            }
+        }
+        let msg = match received {
+            Ok(msg) => msg,
+            Err(mpsc::RecvTimeoutError::Timeout) => continue,
+            Err(mpsc::RecvTimeoutError::Disconnected) => break,
+        };
         match msg {
             Some(msg) => {
                 let res = json::parse(&msg.payload_str());
@@ -95,11 +149,28 @@ fn main() {
                     error!("Problems inserting into SQLite: {}", err);
                     continue;
                 }
+
+                let reading = match (temp, relative_humidity, time.and_then(columnar::parse_time)) {
+                    (Some(temperature), Some(relative_humidity), Some(time)) =>
+                        columnar::Reading { time, temperature, relative_humidity },
+                    _ => {
+                        error!("Incomplete reading, not storing in segment");
+                        continue;
+                    }
+                };
+                let device = payload["device"].as_str().unwrap_or(msg.topic());
+                if let Err(err) = segments.push(device, &reading) {
+                    error!("Problems writing segment: {}", err);
+                }
             }
             None => ()
         }
     }
 
+    if let Err(err) = segments.seal_all() {
+        error!("Failed to seal segments: {}", err);
+    }
+
     if let Err(err) = cli.disconnect(None) {
         error!("Failed to disconnect from broker: {}", err);
     }
@@ -0,0 +1,312 @@
+/* Drives the connection manager with scripted event sequences and
+   checks the action, state and bookkeeping after each step. */
+#include <stdio.h>
+#include <string.h>
+
+#include "conn_manager.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+  do {                                                                  \
+    if (!(cond)) {                                                      \
+      fprintf(stderr, "%s:%d: %s: check failed: %s\n",                  \
+              __FILE__, __LINE__, __func__, #cond);                     \
+      failures++;                                                       \
+    }                                                                   \
+  } while (0)
+
+static conn_manager_action
+send(conn_manager *cm, conn_manager_event_type type, uint32_t now_ms)
+{
+  conn_manager_event event = { .type = type, .now_ms = now_ms };
+  return conn_manager_handle(cm, &event);
+}
+
+static conn_manager_action
+scan_done(conn_manager *cm, const conn_manager_scan_result *results, int num_results)
+{
+  conn_manager_event event = {
+    .type = CONN_MANAGER_EVENT_SCAN_DONE,
+    .results = results,
+    .num_results = num_results
+  };
+  return conn_manager_handle(cm, &event);
+}
+
+static const conn_manager_scan_result home = {
+  .ssid = "home", .bssid = { 0x02, 0, 0, 0, 0, 1 }, .channel = 6, .rssi = -60
+};
+
+/* A manager connected to "home" on channel 6. */
+static void
+connect_home(conn_manager *cm)
+{
+  conn_manager_init(cm, 1234);
+  conn_manager_add_ap(cm, "home", "secret");
+  send(cm, CONN_MANAGER_EVENT_START, 0);
+  scan_done(cm, &home, 1);
+  send(cm, CONN_MANAGER_EVENT_GOT_IP, 10);
+}
+
+static void
+test_disconnect_reconnects_immediately()
+{
+  conn_manager cm;
+  conn_manager_action action;
+
+  conn_manager_init(&cm, 1234);
+  conn_manager_add_ap(&cm, "home", "secret");
+
+  action = send(&cm, CONN_MANAGER_EVENT_START, 0);
+  CHECK(action.type == CONN_MANAGER_ACTION_SCAN);
+  CHECK(action.channel == 0);
+  CHECK(cm.state == CONN_MANAGER_SCANNING);
+
+  action = scan_done(&cm, &home, 1);
+  CHECK(action.type == CONN_MANAGER_ACTION_CONNECT);
+  CHECK(action.ap == 0);
+  CHECK(action.channel == 6);
+  CHECK(cm.aps[0].bssid_known);
+  CHECK(cm.tried == 1);
+
+  action = send(&cm, CONN_MANAGER_EVENT_GOT_IP, 100);
+  CHECK(action.type == CONN_MANAGER_ACTION_NONE);
+  CHECK(cm.state == CONN_MANAGER_CONNECTED);
+  CHECK(cm.aps[0].successes == 1);
+
+  action = send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 5000);
+  CHECK(action.type == CONN_MANAGER_ACTION_CONNECT);
+  CHECK(action.ap == 0);
+  CHECK(action.channel == 6);
+  CHECK(cm.state == CONN_MANAGER_CONNECTING);
+  CHECK(cm.tried == 1);
+
+  send(&cm, CONN_MANAGER_EVENT_GOT_IP, 5150);
+  CHECK(cm.state == CONN_MANAGER_CONNECTED);
+  CHECK(cm.reconnects == 1);
+  CHECK(cm.last_reconnect_ms == 150);
+}
+
+static void
+test_failed_fast_scan_falls_back()
+{
+  conn_manager cm;
+  conn_manager_action action;
+
+  connect_home(&cm);
+  send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 1000);
+  action = send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 1100);
+  CHECK(action.type == CONN_MANAGER_ACTION_WAIT);
+  CHECK(cm.state == CONN_MANAGER_BACKOFF);
+
+  action = send(&cm, CONN_MANAGER_EVENT_TIMER, 2000);
+  CHECK(action.type == CONN_MANAGER_ACTION_SCAN);
+  CHECK(action.channel == 6);
+  CHECK(cm.tried == 0);
+
+  /* Nothing on the known channel: try all channels before giving up. */
+  action = scan_done(&cm, NULL, 0);
+  CHECK(action.type == CONN_MANAGER_ACTION_SCAN);
+  CHECK(action.channel == 0);
+  CHECK(cm.aps[0].channel == 6);
+
+  action = scan_done(&cm, NULL, 0);
+  CHECK(action.type == CONN_MANAGER_ACTION_WAIT);
+  CHECK(cm.state == CONN_MANAGER_BACKOFF);
+  CHECK(cm.aps[0].channel == 0);
+  CHECK(!cm.aps[0].bssid_known);
+}
+
+static void
+test_scan_failure_backs_off()
+{
+  conn_manager cm;
+  conn_manager_action action;
+
+  connect_home(&cm);
+  send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 1000);
+  send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 1100);
+  action = send(&cm, CONN_MANAGER_EVENT_TIMER, 2000);
+  CHECK(action.type == CONN_MANAGER_ACTION_SCAN);
+
+  /* A scan that never started says nothing about the APs. */
+  action = send(&cm, CONN_MANAGER_EVENT_SCAN_FAILED, 2000);
+  CHECK(action.type == CONN_MANAGER_ACTION_WAIT);
+  CHECK(cm.state == CONN_MANAGER_BACKOFF);
+  CHECK(cm.aps[0].channel == 6);
+  CHECK(cm.aps[0].bssid_known);
+
+  action = send(&cm, CONN_MANAGER_EVENT_SCAN_FAILED, 2000);
+  CHECK(action.type == CONN_MANAGER_ACTION_NONE);
+}
+
+static void
+test_backoff_grows_with_jitter_and_cap()
+{
+  conn_manager cm;
+  conn_manager_action action;
+
+  connect_home(&cm);
+  send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 1000);
+  for (uint32_t attempt = 0; attempt < 20; attempt++) {
+    uint32_t d = CONN_MANAGER_BACKOFF_MAX_MS;
+    if (attempt < 16 && (CONN_MANAGER_BACKOFF_MIN_MS << attempt) < d) {
+      d = CONN_MANAGER_BACKOFF_MIN_MS << attempt;
+    }
+
+    action = send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 0);
+    CHECK(action.type == CONN_MANAGER_ACTION_WAIT);
+    CHECK(action.delay_ms >= d / 2);
+    CHECK(action.delay_ms <= d);
+    CHECK(action.delay_ms <= CONN_MANAGER_BACKOFF_MAX_MS);
+
+    action = send(&cm, CONN_MANAGER_EVENT_TIMER, 0);
+    CHECK(action.type == CONN_MANAGER_ACTION_SCAN);
+    action = scan_done(&cm, &home, 1);
+    CHECK(action.type == CONN_MANAGER_ACTION_CONNECT);
+  }
+  CHECK(cm.aps[0].failures == 20);
+
+  /* A connection resets the backoff. */
+  send(&cm, CONN_MANAGER_EVENT_GOT_IP, 0);
+  CHECK(cm.attempt == 0);
+  CHECK(cm.aps[0].failures == 0);
+}
+
+static void
+test_ranking()
+{
+  conn_manager cm;
+  conn_manager_action action;
+  conn_manager_scan_result results[] = {
+    { .ssid = "weak", .channel = 1, .rssi = -75 },
+    { .ssid = "medium", .channel = 6, .rssi = -55 },
+    { .ssid = "strong", .channel = 11, .rssi = -45 },
+    { .ssid = "stranger", .channel = 3, .rssi = -20 }
+  };
+
+  conn_manager_init(&cm, 1);
+  conn_manager_add_ap(&cm, "weak", "a");
+  conn_manager_add_ap(&cm, "medium", "b");
+  conn_manager_add_ap(&cm, "strong", "c");
+
+  /* Plain RSSI order, unknown networks ignored. */
+  send(&cm, CONN_MANAGER_EVENT_START, 0);
+  action = scan_done(&cm, results, 4);
+  CHECK(action.type == CONN_MANAGER_ACTION_CONNECT);
+  CHECK(action.ap == 2);
+
+  /* A failure moves on to the next best seen AP without a rescan. */
+  action = send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 0);
+  CHECK(action.type == CONN_MANAGER_ACTION_CONNECT);
+  CHECK(action.ap == 1);
+  CHECK(action.channel == 6);
+  CHECK(cm.tried == ((1 << 2) | (1 << 1)));
+  CHECK(cm.aps[2].failures == 1);
+
+  /* A history of successes outranks a stronger signal... */
+  conn_manager_init(&cm, 1);
+  conn_manager_add_ap(&cm, "weak", "a");
+  conn_manager_add_ap(&cm, "strong", "c");
+  cm.aps[0].successes = CONN_MANAGER_SUCCESS_CAP;
+  send(&cm, CONN_MANAGER_EVENT_START, 0);
+  action = scan_done(&cm, results, 4);
+  CHECK(action.ap == 0);
+
+  /* ...and recent failures count against it. */
+  conn_manager_init(&cm, 1);
+  conn_manager_add_ap(&cm, "medium", "b");
+  conn_manager_add_ap(&cm, "strong", "c");
+  cm.aps[1].failures = 2;
+  send(&cm, CONN_MANAGER_EVENT_START, 0);
+  action = scan_done(&cm, results, 4);
+  CHECK(action.ap == 0);
+}
+
+static void
+test_add_ap_replaces_worst()
+{
+  conn_manager cm;
+  const int8_t rssi[CONN_MANAGER_MAX_APS] = { -50, -80, -40, -60 };
+
+  conn_manager_init(&cm, 1);
+  for (int i = 0; i < CONN_MANAGER_MAX_APS; i++) {
+    char ssid[8];
+    snprintf(ssid, sizeof(ssid), "ap%d", i);
+    CHECK(conn_manager_add_ap(&cm, ssid, "pw"));
+    cm.aps[i].channel = 1;
+    cm.aps[i].rssi = rssi[i];
+  }
+  CHECK(cm.num_aps == CONN_MANAGER_MAX_APS);
+
+  /* Updating known credentials does not take a slot. */
+  CHECK(conn_manager_add_ap(&cm, "ap2", "new"));
+  CHECK(cm.num_aps == CONN_MANAGER_MAX_APS);
+  CHECK(strcmp(cm.aps[2].password, "new") == 0);
+
+  cm.dirty = false;
+  CHECK(conn_manager_add_ap(&cm, "newcomer", "pw"));
+  CHECK(cm.num_aps == CONN_MANAGER_MAX_APS);
+  CHECK(strcmp(cm.aps[1].ssid, "newcomer") == 0);
+  CHECK(cm.aps[1].channel == 0);
+  CHECK(cm.aps[1].successes == 0);
+  CHECK(strcmp(cm.aps[0].ssid, "ap0") == 0);
+  CHECK(strcmp(cm.aps[2].ssid, "ap2") == 0);
+  CHECK(strcmp(cm.aps[3].ssid, "ap3") == 0);
+  CHECK(cm.dirty);
+
+  char too_long[CONN_MANAGER_SSID_LEN + 1];
+  memset(too_long, 'x', sizeof(too_long) - 1);
+  too_long[sizeof(too_long) - 1] = '\0';
+  CHECK(!conn_manager_add_ap(&cm, too_long, "pw"));
+}
+
+static void
+test_dirty_only_on_persistent_changes()
+{
+  conn_manager cm;
+
+  connect_home(&cm);
+  CHECK(cm.dirty);
+  cm.dirty = false;
+
+  /* Rejoining the same BSSID only bumps the success count. */
+  for (int i = 0; i < 2 * CONN_MANAGER_SUCCESS_CAP; i++) {
+    send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 0);
+    send(&cm, CONN_MANAGER_EVENT_GOT_IP, 0);
+  }
+  CHECK(cm.aps[0].successes == CONN_MANAGER_SUCCESS_CAP);
+  cm.dirty = false;
+  send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 0);
+  send(&cm, CONN_MANAGER_EVENT_GOT_IP, 0);
+  CHECK(!cm.dirty);
+
+  /* A failure followed by success resets history worth saving. */
+  send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 0);
+  send(&cm, CONN_MANAGER_EVENT_DISCONNECTED, 0);
+  send(&cm, CONN_MANAGER_EVENT_TIMER, 0);
+  scan_done(&cm, &home, 1);
+  CHECK(!cm.dirty);
+  send(&cm, CONN_MANAGER_EVENT_GOT_IP, 0);
+  CHECK(cm.dirty);
+}
+
+int
+main()
+{
+  test_disconnect_reconnects_immediately();
+  test_failed_fast_scan_falls_back();
+  test_scan_failure_backs_off();
+  test_backoff_grows_with_jitter_and_cap();
+  test_ranking();
+  test_add_ap_replaces_worst();
+  test_dirty_only_on_persistent_changes();
+
+  if (failures != 0) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  printf("conn_manager: all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,26 @@
+#!/bin/sh
+# Generates ECDSA P-256 device credentials signed by the project CA and
+# writes them as DER next to the existing RSA credentials.
+#
+# Usage: tools/gen_ecdsa_credentials.sh <ca.key> [common name]
+set -e
+
+cd "$(dirname "$0")/../certificate-collection"
+
+CA_KEY="$1"
+CN="${2:-temperature_sensor}"
+OUT=certificates/temperature_sensor_ecdsa
+
+if [ -z "$CA_KEY" ]; then
+    echo "usage: $0 <ca.key> [common name]" >&2
+    exit 1
+fi
+
+openssl ecparam -name prime256v1 -genkey -noout -out "$OUT.key"
+openssl req -new -key "$OUT.key" -subj "/CN=$CN" -out "$OUT.csr"
+openssl x509 -req -in "$OUT.csr" -CA ca/ca.pem -CAkey "$CA_KEY" \
+        -CAcreateserial -days 3650 -sha256 -out "$OUT.pem"
+
+openssl x509 -in "$OUT.pem" -outform DER -out "$OUT.der"
+openssl ec -in "$OUT.key" -outform DER -out "${OUT}_key.der"
+rm "$OUT.csr"